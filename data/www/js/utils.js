@@ -404,6 +404,12 @@ function submitChanges (el) {
     el.setAttribute("data-updating", "");
   }
 
+  // settings go through the WebSocket if it is open, commands through /control
+  if(el.type != "submit" && settingsSocket && settingsSocket.readyState === 1) {
+    settingsSocket.send(encodeSetting(el.id, refreshControl(el)));
+    return true;
+  }
+
   let host = document.location.origin;
   let value = encodeURIComponent(refreshControl(el));
 
@@ -417,6 +423,63 @@ function submitChanges (el) {
     return true;
 }
 
+// WebSocket channel of the settings
+var settingsSocket = null;
 
+// encodes a 'v' message: 'v', key length, key, 'i' + int32 (little endian) or 's' + UTF-8 string
+function encodeSetting(key, value) {
+  const enc = new TextEncoder();
+  const bkey = enc.encode(key);
+  const isInt = /^-?\d+$/.test(String(value));
+  const bval = isInt ? new Uint8Array(new Int32Array([parseInt(value)]).buffer) : enc.encode(String(value));
+  
+  var msg = new Uint8Array(3 + bkey.length + bval.length);
+  msg[0] = 'v'.charCodeAt(0);
+  msg[1] = bkey.length;
+  msg.set(bkey, 2);
+  msg[2 + bkey.length] = (isInt ? 'i' : 's').charCodeAt(0);
+  msg.set(bval, 3 + bkey.length);
+  return msg;
+}
 
+// decodes a 'u' (update) or 'e' (error) message; returns null for the video frames
+function decodeSetting(data) {
+  const msg = new Uint8Array(data);
+  const dec = new TextDecoder();
+  if(msg.length < 3) return null;
+
+  if(msg[0] == 'e'.charCodeAt(0)) 
+    return {"key": dec.decode(msg.subarray(3, 3 + msg[2])), "error": msg[1]};
+  if(msg[0] != 'u'.charCodeAt(0)) return null;
+
+  const klen = msg[1];
+  const key = dec.decode(msg.subarray(2, 2 + klen));
+  const type = String.fromCharCode(msg[2 + klen]);
+  const val = msg.subarray(3 + klen);
+  if(type == 'i' && val.length == 4) 
+    return {"key": key, "value": new DataView(val.buffer, val.byteOffset, 4).getInt32(0, true)};
+  if(type == 's') 
+    return {"key": key, "value": dec.decode(val)};
+  return {"key": key};
+}
 
+// opens the settings channel; onUpdate(key, value) is called when a setting is changed by any client
+function openSettingsSocket(onUpdate) {
+  const url = (location.protocol === 'https:' ? 'wss://' : 'ws://') + location.host + '/ws';
+  settingsSocket = new WebSocket(url);
+  settingsSocket.binaryType = 'arraybuffer';
+  settingsSocket.onmessage = (event) => {
+    if(typeof event.data === 'string') return;
+    const setting = decodeSetting(event.data);
+    if(!setting) return;
+    if(setting.error) 
+      console.log(`setting ${setting.key} rejected, error ${setting.error}`);
+    else if(setting.value !== undefined && onUpdate) 
+      onUpdate(setting.key, setting.value);
+  };
+  settingsSocket.onclose = () => {
+    // fall back to /control until the channel is open again
+    settingsSocket = null;
+    setTimeout(() => openSettingsSocket(onUpdate), 5000);
+  };
+}
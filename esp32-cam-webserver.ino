@@ -127,9 +127,14 @@ void setup() {
 
     // Start the filesystem 
     if(!filesystemStart()) {
+#ifdef ENABLE_EMBEDDED_ASSETS
+        // the web UI is in the firmware, so the camera can still be reached and set up with the defaults
+        ESP_LOGE(TAG, "Unable to mount the filesystem, starting with the default settings");
+#else
         ESP_LOGE(TAG, "Unable to mount the filesystem. Fatal error, halting ... ");
         recordError(FILESYSTEM_FAILURE);
         hibernate();
+#endif
     }
 
     delay(200); // a short delay to let spi bus settle after init
@@ -220,6 +225,7 @@ void loop() {
                     if(AppMailSender.mailImage() != OK) {
                         // if mailImage fails it means something wrong with the camera, need reboot
                         recordError(CAMERA_FAILURE);
+                        CLAppComponent::flushPrefs();
                         scheduleReboot(3);
                     }
                 }
@@ -0,0 +1,182 @@
+# PlatformIO extra script: compresses the static web assets before the file system image is built.
+#
+# For every page in data/www and every file in the folders listed in the "mapping" of the httpd configs in the
+# data folder, a gzipped copy (<file>.gz) is written next to it if it is a text asset, and the content hash of
+# the file is added to /assets.json. The page templates (pages with %VAR% placeholders) are marked as such
+# and left uncompressed. The web server serves the gzipped copy to the clients accepting it, and uses the hash as a
+# strong ETag, so the browsers can revalidate the cached assets with a 304 response.
+#
+# With ENABLE_EMBEDDED_ASSETS in the build flags, the script also compiles the pages and the mapped folders of
+# data/www into src/embedded_assets.h (gzipped, except the templates), which is included by the web server
+# to serve them from the firmware instead of the file system.
+#
+# The generated files are not to be committed; they are re-created on each build of the image.
+# To prepare the data folder for an SD card, the script can be run on its own: python gzip_assets.py <data folder>
+# and with --embed <header> to generate the embedded assets for a build without PlatformIO.
+
+import glob
+import gzip
+import hashlib
+import json
+import os
+import re
+import sys
+
+GZIP_TYPES = (".js", ".css", ".svg", ".html", ".htm", ".json", ".txt", ".ico")
+MANIFEST = "assets.json"
+EMBEDDED_HEADER = os.path.join("src", "embedded_assets.h")
+
+CONTENT_TYPES = {
+    ".js": "application/javascript",
+    ".css": "text/css",
+    ".html": "text/html",
+    ".htm": "text/html",
+    ".json": "application/json",
+    ".svg": "image/svg+xml",
+    ".png": "image/png",
+    ".jpg": "image/jpeg",
+    ".ico": "image/x-icon",
+    ".txt": "text/plain",
+}
+
+# placeholder substituted by the template processor of the web server, e.g. %CAMNAME%
+TEMPLATE_VAR = re.compile(rb"%[A-Z_]+%")
+
+
+def mapped_folders(data_dir):
+    folders = set()
+    for config in glob.glob(os.path.join(data_dir, "*httpd.json")):
+        try:
+            with open(config) as f:
+                mapping = json.load(f).get("mapping", [])
+        except (OSError, ValueError) as e:
+            print("gzip_assets: skipping %s (%s)" % (config, e))
+            continue
+        for entry in mapping:
+            path = entry.get("path", "").strip("/")
+            if path:
+                folders.add(path)
+    return sorted(folders)
+
+
+def asset_files(data_dir):
+    """Pages in the www folder and the files of the mapped folders, relative to the data folder"""
+    files = ["www/" + name for name in os.listdir(os.path.join(data_dir, "www"))
+             if name.lower().endswith((".html", ".htm"))]
+    for folder in mapped_folders(data_dir):
+        for root, _, names in os.walk(os.path.join(data_dir, folder)):
+            files += [os.path.relpath(os.path.join(root, name), data_dir) for name in names]
+    return sorted(set(f for f in files if not f.endswith(".gz")))
+
+
+def is_template(rel, content):
+    return rel.lower().endswith((".html", ".htm")) and TEMPLATE_VAR.search(content) is not None
+
+
+def default_mappings(data_dir):
+    try:
+        with open(os.path.join(data_dir, "default_httpd.json")) as f:
+            return json.load(f).get("mapping", [])
+    except (OSError, ValueError):
+        return []
+
+
+def embed_assets(data_dir, header):
+    arrays = []
+    entries = []
+    total = 0
+    for i, rel in enumerate(asset_files(data_dir)):
+        with open(os.path.join(data_dir, rel), "rb") as f:
+            content = f.read()
+
+        fs_path = "/" + rel.replace(os.sep, "/")
+        content_type = CONTENT_TYPES.get(os.path.splitext(rel)[1].lower(), "application/octet-stream")
+        digest = hashlib.sha256(content).hexdigest()[:16]
+
+        # the templates are kept as is for the template processor
+        tmpl = is_template(rel, content)
+        gz = False
+        if rel.lower().endswith(GZIP_TYPES) and not tmpl:
+            packed = gzip.compress(content, compresslevel=9, mtime=0)
+            if len(packed) < len(content):
+                content = packed
+                gz = True
+        total += len(content)
+
+        lines = [", ".join("0x%02x" % b for b in content[j:j + 16]) for j in range(0, len(content), 16)]
+        arrays.append("static const uint8_t embedded_asset_%d[] PROGMEM = {\n    %s\n};\n" % (i, ",\n    ".join(lines)))
+        entries.append('    {"%s", "%s", embedded_asset_%d, sizeof(embedded_asset_%d), "%s", %s, %s},'
+                       % (fs_path, content_type, i, i, digest, "true" if gz else "false", "true" if tmpl else "false"))
+
+    mappings = ['    {"%s", "%s"},' % (m.get("uri", ""), m.get("path", "")) for m in default_mappings(data_dir)]
+
+    text = ("// Generated by scripts/gzip_assets.py from the data folder, do not edit\n"
+            "#ifndef embedded_assets_h\n#define embedded_assets_h\n\n"
+            + "\n".join(arrays)
+            + "\nstatic const EmbeddedAsset embedded_assets[] = {\n" + "\n".join(entries) + "\n};\n"
+            + "\nstatic const UriMapping embedded_mappings[] = {\n" + "\n".join(mappings) + "\n};\n"
+            + "\n#endif\n")
+
+    # the header is only rewritten if the assets have changed, so the web server is not rebuilt needlessly
+    if os.path.exists(header):
+        with open(header) as f:
+            if f.read() == text:
+                return
+    with open(header, "w") as f:
+        f.write(text)
+
+    print("gzip_assets: %d assets embedded, %d bytes" % (len(entries), total))
+
+
+def build_assets(data_dir):
+    manifest = {}
+    saved = 0
+
+    for rel in asset_files(data_dir):
+        path = os.path.join(data_dir, rel)
+        with open(path, "rb") as f:
+            content = f.read()
+
+        fs_path = "/" + rel.replace(os.sep, "/")
+        entry = {"hash": hashlib.sha256(content).hexdigest()[:16]}
+
+        # the templates are rendered by the server, so they are not compressed
+        if is_template(rel, content):
+            entry["tmpl"] = True
+        elif rel.lower().endswith(GZIP_TYPES):
+            # mtime=0 keeps the output, and so the image, reproducible
+            packed = gzip.compress(content, compresslevel=9, mtime=0)
+            if len(packed) < len(content):
+                with open(path + ".gz", "wb") as f:
+                    f.write(packed)
+                entry["gz"] = True
+                saved += len(content) - len(packed)
+
+        if not entry.get("gz") and os.path.exists(path + ".gz"):
+            os.remove(path + ".gz")
+
+        manifest[fs_path] = entry
+
+    # stale copies of removed assets
+    for path in glob.glob(os.path.join(data_dir, "www", "**", "*.gz"), recursive=True):
+        if not os.path.exists(path[:-3]):
+            os.remove(path)
+
+    with open(os.path.join(data_dir, MANIFEST), "w") as f:
+        json.dump(manifest, f, separators=(",", ":"), sort_keys=True)
+
+    print("gzip_assets: %d assets, %d bytes saved by compression" % (len(manifest), saved))
+
+
+if __name__ == "__main__":
+    args = sys.argv[1:]
+    if len(args) >= 2 and args[-2] == "--embed":
+        embed_assets(args[0] if len(args) > 2 else "data", args[-1])
+    else:
+        build_assets(args[0] if args else "data")
+else:
+    Import("env")
+    if set(["buildfs", "uploadfs", "uploadfsota"]) & set(COMMAND_LINE_TARGETS):
+        build_assets(env.subst("$PROJECT_DATA_DIR"))
+    if any("ENABLE_EMBEDDED_ASSETS" in flag for flag in env.Flatten(env.get("BUILD_FLAGS", []))):
+        embed_assets(env.subst("$PROJECT_DATA_DIR"), os.path.join(env.subst("$PROJECT_DIR"), EMBEDDED_HEADER))
@@ -1,6 +1,142 @@
 #include "app_cam.h"
 
-CLAppCam::CLAppCam() {
+#include <esp_sleep.h>
+
+// kept over a deep sleep, cleared by any other reset
+RTC_DATA_ATTR static CamSleepState sleep_state;
+
+// exposure and gain registers of the OV2640 in the sensor bank (0x100):
+// GAIN, COM1 (AEC[1:0]), AEC (AEC[9:2]), REG45 (AEC[15:10])
+static const uint16_t ov2640_exposure_regs[CAM_SLEEP_REGS] = {0x100, 0x104, 0x110, 0x145};
+
+// FNV-1a of the sleep state up to the checksum
+static uint32_t sleepStateChecksum(const CamSleepState & state) {
+    const uint8_t * data = (const uint8_t*)&state;
+    uint32_t hash = 2166136261u;
+    for(size_t i=0; i < offsetof(CamSleepState, checksum); i++) hash = (hash ^ data[i]) * 16777619u;
+    return hash;
+}
+
+// accessors of the sensor settings for the property table
+#define SENSOR_PROPERTY(name, setter, field) \
+    static int cam_set_##name(int val) {sensor_t * s = AppCam.getSensor(); return (s?s->setter(s, val):FAIL);} \
+    static int cam_get_##name() {sensor_t * s = AppCam.getSensor(); return (s?s->status.field:0);}
+
+SENSOR_PROPERTY(brightness, set_brightness, brightness)
+SENSOR_PROPERTY(contrast, set_contrast, contrast)
+SENSOR_PROPERTY(saturation, set_saturation, saturation)
+SENSOR_PROPERTY(sharpness, set_sharpness, sharpness)
+SENSOR_PROPERTY(denoise, set_denoise, denoise)
+SENSOR_PROPERTY(special_effect, set_special_effect, special_effect)
+SENSOR_PROPERTY(wb_mode, set_wb_mode, wb_mode)
+SENSOR_PROPERTY(awb, set_whitebal, awb)
+SENSOR_PROPERTY(awb_gain, set_awb_gain, awb_gain)
+SENSOR_PROPERTY(aec, set_exposure_ctrl, aec)
+SENSOR_PROPERTY(aec2, set_aec2, aec2)
+SENSOR_PROPERTY(ae_level, set_ae_level, ae_level)
+SENSOR_PROPERTY(aec_value, set_aec_value, aec_value)
+SENSOR_PROPERTY(agc, set_gain_ctrl, agc)
+SENSOR_PROPERTY(agc_gain, set_agc_gain, agc_gain)
+SENSOR_PROPERTY(bpc, set_bpc, bpc)
+SENSOR_PROPERTY(wpc, set_wpc, wpc)
+SENSOR_PROPERTY(raw_gma, set_raw_gma, raw_gma)
+SENSOR_PROPERTY(lenc, set_lenc, lenc)
+SENSOR_PROPERTY(vflip, set_vflip, vflip)
+SENSOR_PROPERTY(hmirror, set_hmirror, hmirror)
+SENSOR_PROPERTY(dcw, set_dcw, dcw)
+SENSOR_PROPERTY(colorbar, set_colorbar, colorbar)
+
+static int cam_set_gainceiling(int val) {
+    sensor_t * s = AppCam.getSensor(); 
+    return (s?s->set_gainceiling(s, (gainceiling_t)val):FAIL);
+}
+static int cam_get_gainceiling() {sensor_t * s = AppCam.getSensor(); return (s?s->status.gainceiling:0);}
+
+static int cam_get_pid() {sensor_t * s = AppCam.getSensor(); return (s?s->id.PID:0);}
+static int cam_get_ver() {sensor_t * s = AppCam.getSensor(); return (s?s->id.VER:0);}
+
+static int cam_set_framesize(int val) {return AppCam.setFramesize(val);}
+static int cam_get_framesize() {return AppCam.getFramesize();}
+static int cam_set_quality(int val) {return AppCam.setQuality(val);}
+static int cam_get_quality() {return AppCam.getQuality();}
+
+static int cam_set_xclk(int val) {
+    AppCam.setXclk(val);
+    sensor_t * s = AppCam.getSensor();
+    return (s?s->set_xclk(s, LEDC_TIMER_0, val):FAIL);
+}
+static int cam_get_xclk() {return AppCam.getXclk();}
+
+static int cam_set_rotate(int val) {AppCam.setRotation(val); return OK;}
+static int cam_get_rotate() {return AppCam.getRotation();}
+static int cam_set_frame_rate(int val) {AppCam.setFrameRate(val); return OK;}
+static int cam_get_frame_rate() {return AppCam.getFrameRate();}
+static int cam_set_adaptive(int val) {AppCam.setAdaptive(val); return OK;}
+
+// the lamp can be controlled only if its PWM is configured
+static int cam_set_lamp(int val) {
+    if(AppCam.getLamp() == -1) return FAIL;
+    AppCam.setLamp(val); 
+    return OK;
+}
+static int cam_get_lamp() {return AppCam.getLamp();}
+static int cam_set_autolamp(int val) {
+    if(AppCam.getLamp() == -1) return FAIL;
+    AppCam.setAutoLamp(val); 
+    return OK;
+}
+static int cam_get_autolamp() {return AppCam.isAutoLamp();}
+static int cam_set_flashlamp(int val) {
+    if(AppCam.getLamp() == -1) return FAIL;
+    AppCam.setFlashLamp(val); 
+    return OK;
+}
+static int cam_get_flashlamp() {return AppCam.getFlashLamp();}
+
+// Properties of the camera, in the order of the preferences file. The ranges are the widest ones 
+// of the supported sensors; the sensor driver rejects the values it doesn't support.
+// The sensor switches are integers, as in the sensor status.
+// The lamp settings depend on the PWM configuration, so they are loaded by loadFromJson() itself.
+static constexpr PropertyDef cam_properties[] = {
+    intProperty(CAM_ROTATE, -90, 90, PROP_PERSIST | PROP_INFO, cam_set_rotate, cam_get_rotate),
+    intProperty(CAM_PID, 0, 0, PROP_SAVE | PROP_INFO, nullptr, cam_get_pid),
+    intProperty(CAM_VER, 0, 0, PROP_SAVE | PROP_INFO, nullptr, cam_get_ver),
+    intProperty(CAM_FRAMESIZE, 0, FRAMESIZE_INVALID - 1, PROP_PERSIST | PROP_INFO, cam_set_framesize, cam_get_framesize),
+    intProperty(CAM_FRAME_RATE, 1, 60, PROP_PERSIST | PROP_INFO, cam_set_frame_rate, cam_get_frame_rate),
+    intProperty(CAM_QUALITY, 0, 63, PROP_PERSIST, cam_set_quality, cam_get_quality),
+    intProperty(CAM_XCLK, 2, 32, PROP_PERSIST, cam_set_xclk, cam_get_xclk),
+    intProperty(CAM_BRIGHTNESS, -3, 3, PROP_PERSIST, cam_set_brightness, cam_get_brightness),
+    intProperty(CAM_CONTRAST, -3, 3, PROP_PERSIST, cam_set_contrast, cam_get_contrast),
+    intProperty(CAM_SATURATION, -4, 4, PROP_PERSIST, cam_set_saturation, cam_get_saturation),
+    intProperty(CAM_SHARPNESS, -3, 3, PROP_PERSIST, cam_set_sharpness, cam_get_sharpness),
+    intProperty(CAM_DENOISE, 0, 8, PROP_PERSIST, cam_set_denoise, cam_get_denoise),
+    intProperty(CAM_SPECIAL_EFFECT, 0, 6, PROP_PERSIST, cam_set_special_effect, cam_get_special_effect),
+    intProperty(CAM_WB_MODE, 0, 4, PROP_PERSIST, cam_set_wb_mode, cam_get_wb_mode),
+    intProperty(CAM_AWB, 0, 1, PROP_PERSIST, cam_set_awb, cam_get_awb),
+    intProperty(CAM_AWB_GAIN, 0, 1, PROP_PERSIST, cam_set_awb_gain, cam_get_awb_gain),
+    intProperty(CAM_AEC, 0, 1, PROP_PERSIST, cam_set_aec, cam_get_aec),
+    intProperty(CAM_AEC2, 0, 1, PROP_PERSIST, cam_set_aec2, cam_get_aec2),
+    intProperty(CAM_AE_LEVEL, -5, 5, PROP_PERSIST, cam_set_ae_level, cam_get_ae_level),
+    intProperty(CAM_AEC_VALUE, 0, 1536, PROP_PERSIST, cam_set_aec_value, cam_get_aec_value),
+    intProperty(CAM_AGC, 0, 1, PROP_PERSIST, cam_set_agc, cam_get_agc),
+    intProperty(CAM_AGC_GAIN, 0, 63, PROP_PERSIST, cam_set_agc_gain, cam_get_agc_gain),
+    intProperty(CAM_GAINCEILING, 0, 511, PROP_PERSIST, cam_set_gainceiling, cam_get_gainceiling),
+    intProperty(CAM_BPC, 0, 1, PROP_PERSIST, cam_set_bpc, cam_get_bpc),
+    intProperty(CAM_WPC, 0, 1, PROP_PERSIST, cam_set_wpc, cam_get_wpc),
+    intProperty(CAM_RAW_GMA, 0, 1, PROP_PERSIST, cam_set_raw_gma, cam_get_raw_gma),
+    intProperty(CAM_LENC, 0, 1, PROP_PERSIST, cam_set_lenc, cam_get_lenc),
+    intProperty(CAM_VFLIP, 0, 1, PROP_PERSIST, cam_set_vflip, cam_get_vflip),
+    intProperty(CAM_HMIRROR, 0, 1, PROP_PERSIST, cam_set_hmirror, cam_get_hmirror),
+    intProperty(CAM_DCW, 0, 1, PROP_PERSIST, cam_set_dcw, cam_get_dcw),
+    intProperty(CAM_COLORBAR, 0, 1, PROP_PERSIST, cam_set_colorbar, cam_get_colorbar),
+    intProperty(CAM_LAMP, 0, 100, PROP_SAVE, cam_set_lamp, cam_get_lamp),
+    boolProperty(CAM_AUTOLAMP, PROP_SAVE, cam_set_autolamp, cam_get_autolamp),
+    intProperty(CAM_FLASHLAMP, 0, 100, PROP_SAVE, cam_set_flashlamp, cam_get_flashlamp),
+    // the adaptive stream settings are saved as an object, only the switch is a control
+    boolProperty(CAM_ADAPTIVE, 0, cam_set_adaptive, nullptr)
+};
+
+CLAppCam::CLAppCam() : properties(cam_properties) {
     setTag("cam");
 }
 
@@ -72,9 +208,215 @@ int CLAppCam::start() {
 
     }
 
+    // the camera can still run with a smaller ring, e.g. on a board without PSRAM
+    if(ring.init() != OK && ring.init(FRAME_SLOT_MIN_SIZE) != OK)
+        ESP_LOGW(tag, "No memory for the frame ring, the frame slots are allocated on demand");
+
+    if(xTaskCreatePinnedToCore(captureTask, "CaptureTask", CAM_CAPTURE_TASK_STACK, NULL, 
+                               CAM_CAPTURE_TASK_PRIORITY, &_capture_task, CAM_CAPTURE_TASK_CORE) != pdPASS) {
+        critERR = "Failed to start the capture task";
+        setErr(ESP_FAIL);
+        return getLastErr();
+    }
+
+    if(pacer.init(_capture_task, CAM_NOTIFY_DEADLINE) != OK) {
+        critERR = "Failed to create the frame pacer";
+        setErr(ESP_FAIL);
+        return getLastErr();
+    }
+
     return OK;
 }
 
+void captureTask(void * pvParameters) {
+    AppCam.captureLoop();
+}
+
+void IRAM_ATTR CLAppCam::captureLoop() {
+    uint32_t events = 0;
+
+    while(true) {
+        if(_captureClients > 0) {
+            // continuous capture at the highest rate requested by the stream clients
+            if(!pacer.isRunning()) 
+                pacer.start(getCaptureRate());
+            else
+                pacer.setRate(getCaptureRate());
+
+            pacer.wait();
+            if(_captureClients == 0) continue;
+        }
+        else {
+            if(pacer.isRunning()) pacer.stop();
+
+            // idle until a single frame is requested or the capture is started
+            xTaskNotifyWait(0, ULONG_MAX, &events, portMAX_DELAY);
+            if(!(events & (CAM_NOTIFY_FRAME | CAM_NOTIFY_STILL))) continue;
+        }
+
+        // the lamp is lit here, so the requesting task doesn't wait for it to settle. The flash is not 
+        // a change of the lamp setting, so the status and its generation are left alone
+        bool flash = (!pacer.isRunning() && (events & CAM_NOTIFY_STILL) && _lampVal>=0 && _autoLamp);
+        if(flash) {
+            writeLamp(_flashLamp);
+            vTaskDelay(pdMS_TO_TICKS(CAM_LAMP_SETTLE));
+        }
+
+        uint32_t seq = 0;
+        int64_t fb_start = esp_timer_get_time();
+        if(snapToBuffer() == ESP_OK) {
+            int64_t timestamp = esp_timer_get_time();
+            Latency.record(LATENCY_FB_GET, timestamp - fb_start);
+
+            if(!isJPEGinBuffer()) {
+                _captureErrors++;
+            }
+            // the frames are keyed on the driver timestamp, so the latencies downstream include the sensor readout
+            else if(ring.push(getBuffer(), getBufferSize(), getBufferTimestamp()) == OK) {
+                _framesCaptured++;
+                seq = ring.getLatestSeq();
+                notifyWaiters();
+                if(pacer.isRunning()) pacer.frameDone(timestamp);
+            }
+
+            releaseBuffer();
+        }
+        else {
+            _captureErrors++;
+        }
+
+        if(flash) writeLamp(_lampVal);
+
+        // fan out the frame right after it is published; a failed single capture is reported as well, 
+        // so the still requests waiting for it are answered
+        if(_frameHandler && (seq || !pacer.isRunning()) &&
+           xTimerPendFunctionCall(_frameHandler, NULL, seq, pdMS_TO_TICKS(CAM_FRAME_PEND_TIMEOUT)) != pdPASS)
+            ESP_LOGW(tag, "Timer command queue full, frame %u not fanned out", seq);
+    }
+}
+
+void CLAppCam::startCapture() {
+    _captureClients++;
+    if(_captureClients == 1) {
+        if(sensor) rateCtl.reset(sensor->status.quality, sensor->status.framesize);
+        if(_capture_task) xTaskNotify(_capture_task, CAM_NOTIFY_START, eSetBits);
+    }
+}
+
+void CLAppCam::stopCapture() {
+    if(_captureClients > 0) _captureClients--;
+    // restore the settings the stream was started with
+    if(_captureClients == 0 && rateCtl.isEnabled() && sensor) {
+        if(sensor->status.framesize != rateCtl.getBaseFramesize())
+            sensor->set_framesize(sensor, (framesize_t)rateCtl.getBaseFramesize());
+        if(sensor->status.quality != rateCtl.getBaseQuality())
+            sensor->set_quality(sensor, rateCtl.getBaseQuality());
+    }
+}
+
+void CLAppCam::setAdaptive(bool val) {
+    RateCtlConfig cfg = rateCtl.getConfig();
+    cfg.enabled = val;
+    rateCtl.configure(cfg);
+    if(sensor) rateCtl.reset(sensor->status.quality, sensor->status.framesize);
+}
+
+int CLAppCam::getFramesize() {
+    if(!sensor) return 0;
+    return (isCapturing() && isAdaptive()?rateCtl.getBaseFramesize():sensor->status.framesize);
+}
+
+int CLAppCam::setFramesize(int val) {
+    // the framesize can be changed only in the JPEG mode
+    if(!sensor || sensor->pixformat != PIXFORMAT_JPEG) return FAIL;
+    int res = sensor->set_framesize(sensor, (framesize_t)val);
+    // restart the adaptive controller from the new settings
+    if(isAdaptive()) setAdaptive(true);
+    return res;
+}
+
+int CLAppCam::getQuality() {
+    if(!sensor) return 0;
+    return (isCapturing() && isAdaptive()?rateCtl.getBaseQuality():sensor->status.quality);
+}
+
+int CLAppCam::setQuality(int val) {
+    if(!sensor) return FAIL;
+    int res = sensor->set_quality(sensor, val);
+    if(isAdaptive()) setAdaptive(true);
+    return res;
+}
+
+void CLAppCam::adaptStream(uint32_t frames, uint32_t bytes, uint32_t dropped, uint32_t interval_ms) {
+    if(!sensor || !rateCtl.update(frames, bytes, dropped, interval_ms)) return;
+
+    ESP_LOGI(tag, "Adaptive stream: %.1f fps, %.0f kbps -> quality %d, framesize %d", 
+             rateCtl.getFps(), rateCtl.getKbps(), rateCtl.getQuality(), rateCtl.getFramesize());
+
+    // framesize change reconfigures the sensor, so apply it only if it really differs
+    if(sensor->status.framesize != rateCtl.getFramesize())
+        sensor->set_framesize(sensor, (framesize_t)rateCtl.getFramesize());
+    sensor->set_quality(sensor, rateCtl.getQuality());
+}
+
+void CLAppCam::requestFrame() {
+    // while capturing continuously the request is served by the next frame anyway
+    if(_capture_task) xTaskNotify(_capture_task, CAM_NOTIFY_FRAME, eSetBits);
+}
+
+void CLAppCam::requestStill() {
+    if(_capture_task && !isCapturing()) xTaskNotify(_capture_task, CAM_NOTIFY_STILL, eSetBits);
+}
+
+int CLAppCam::waitFrame(uint32_t after_seq, uint32_t timeout_ms) {
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    TickType_t start = xTaskGetTickCount();
+    TickType_t timeout = pdMS_TO_TICKS(timeout_ms);
+
+    while(true) {
+        // the frame is published before the waiters are taken, so either the new sequence is seen here,
+        // or the task is registered in time to be notified
+        bool registered = false;
+        portENTER_CRITICAL(&_waiters_lock);
+        bool ready = (ring.getLatestSeq() != after_seq);
+        for(int i=0; !ready && i < CAM_FRAME_WAITERS; i++) {
+            if(_frame_waiters[i] == self || !_frame_waiters[i]) {
+                _frame_waiters[i] = self;
+                registered = true;
+                break;
+            }
+        }
+        portEXIT_CRITICAL(&_waiters_lock);
+
+        if(ready) return OK;
+
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if(elapsed >= timeout) break;
+
+        // a notification left from an earlier wait only makes the loop check again;
+        // with all the places taken the sequence is polled
+        ulTaskNotifyTake(pdTRUE, (registered?timeout - elapsed:min(timeout - elapsed, pdMS_TO_TICKS(10) + 1)));
+    }
+
+    portENTER_CRITICAL(&_waiters_lock);
+    for(int i=0; i < CAM_FRAME_WAITERS; i++) 
+        if(_frame_waiters[i] == self) _frame_waiters[i] = NULL;
+    portEXIT_CRITICAL(&_waiters_lock);
+    return FAIL;
+}
+
+void CLAppCam::notifyWaiters() {
+    TaskHandle_t waiters[CAM_FRAME_WAITERS];
+
+    portENTER_CRITICAL(&_waiters_lock);
+    memcpy(waiters, _frame_waiters, sizeof(waiters));
+    memset(_frame_waiters, 0, sizeof(_frame_waiters));
+    portEXIT_CRITICAL(&_waiters_lock);
+
+    for(int i=0; i < CAM_FRAME_WAITERS; i++)
+        if(waiters[i]) xTaskNotifyGive(waiters[i]);
+}
+
 int CLAppCam::stop() {
     ESP_LOGI(tag,"Stopping Camera");
     return esp_camera_deinit();
@@ -82,48 +424,22 @@ int CLAppCam::stop() {
 
 
 int CLAppCam::loadFromJson(JsonObject jctx, bool full_set) {
-    // process local settings    
-    frameRate = jctx[FPSTR(CAM_FRAME_RATE)];
-    xclk = jctx[FPSTR(CAM_XCLK)];
-    myRotation = jctx[FPSTR(CAM_ROTATE)];
-
-    // get sensor reference
-    sensor_t * s = esp_camera_sensor_get();
-
-    // process camera settings
-    if(s) {
-        s->set_framesize(s, (framesize_t)jctx[FPSTR(CAM_FRAMESIZE)].as<int>());
-        s->set_quality(s, jctx[FPSTR(CAM_QUALITY)].as<int>());
-        s->set_xclk(s, LEDC_TIMER_0, xclk);
-        s->set_brightness(s, jctx[FPSTR(CAM_BRIGHTNESS)].as<int>());
-        s->set_contrast(s, jctx[FPSTR(CAM_CONTRAST)].as<int>());
-        s->set_saturation(s, jctx[FPSTR(CAM_SATURATION)].as<int>());
-        s->set_sharpness(s, jctx[ FPSTR(CAM_SHARPNESS)].as<int>());
-        s->set_denoise(s, jctx[FPSTR(CAM_DENOISE)].as<int>());
-        s->set_special_effect(s, jctx[FPSTR(CAM_SPECIAL_EFFECT)].as<int>());
-        s->set_wb_mode(s, jctx[FPSTR(CAM_WB_MODE)].as<int>());
-        s->set_whitebal(s, jctx[FPSTR(CAM_AWB)].as<int>());
-        s->set_awb_gain(s, jctx[FPSTR(CAM_AWB_GAIN)].as<int>());
-        s->set_exposure_ctrl(s,jctx[FPSTR(CAM_AEC)].as<int>());
-        s->set_aec2(s, jctx[FPSTR(CAM_AEC2)].as<int>());
-        s->set_ae_level(s, jctx[FPSTR(CAM_AE_LEVEL)].as<int>());
-        s->set_aec_value(s, jctx[FPSTR(CAM_AEC_VALUE)].as<int>());
-        s->set_gain_ctrl(s, jctx[FPSTR(CAM_AGC)].as<int>());
-        s->set_agc_gain(s, jctx[FPSTR(CAM_AGC_GAIN)].as<int>());
-        s->set_gainceiling(s, (gainceiling_t)jctx[FPSTR(CAM_GAINCEILING)].as<int>());
-        s->set_bpc(s, jctx[FPSTR(CAM_BPC)].as<int>());
-        s->set_wpc(s, jctx[FPSTR(CAM_WPC)].as<int>());
-        s->set_raw_gma(s, jctx[FPSTR(CAM_RAW_GMA)].as<int>());
-        s->set_lenc(s, jctx[FPSTR(CAM_LENC)].as<int>());
-        s->set_vflip(s, jctx[FPSTR(CAM_VFLIP)].as<int>());
-        s->set_hmirror(s, jctx[FPSTR(CAM_HMIRROR)].as<int>());
-        s->set_dcw(s, jctx[FPSTR(CAM_DCW)].as<int>());
-        s->set_colorbar(s, jctx[FPSTR(CAM_COLORBAR)].as<int>());
-        
-    }
-    else {
+    // the sensor settings are skipped if the camera failed to initialise
+    if(!sensor) 
         ESP_LOGW(tag,"Failed to get camera handle. Camera settings skipped");
-    }
+
+    int failed = properties.loadFromJson(jctx);
+    if(failed) ESP_LOGW(tag, "%d camera settings failed to load", failed);
+
+    JsonObject joAdaptive = jctx[FPSTR(CAM_ADAPTIVE)];
+    RateCtlConfig cfg;
+    cfg.enabled = joAdaptive[FPSTR(CAM_ADAPTIVE_ENABLED)] | false;
+    cfg.target_fps = joAdaptive[FPSTR(CAM_TARGET_FPS)] | frameRate;
+    cfg.target_kbps = joAdaptive[FPSTR(CAM_TARGET_KBPS)] | 2000;
+    cfg.max_quality = joAdaptive[FPSTR(CAM_MAX_QUALITY)] | 40;
+    cfg.min_framesize = joAdaptive[FPSTR(CAM_MIN_FRAMESIZE)] | (int)FRAMESIZE_QVGA;
+    cfg.quality_step = joAdaptive[FPSTR(CAM_QUALITY_STEP)] | 2;
+    rateCtl.configure(cfg);
 
     _lampVal = jctx[FPSTR(CAM_LAMP)] | -1;
     _autoLamp = jctx[FPSTR(CAM_AUTOLAMP)] | false;
@@ -131,6 +447,14 @@ int CLAppCam::loadFromJson(JsonObject jctx, bool full_set) {
 
     AppPwm.loadFromJson(jctx);
 
+    attachLamp();
+
+    _imagesServed = 0;
+
+    return OK;
+}
+
+void CLAppCam::attachLamp() {
     // First PWM shoudl be reserved for the lamp, if defined.
     ESP32PWM* lampPWM = AppPwm.get(0);
     if( lampPWM != nullptr && _lampVal >= 0) 
@@ -143,9 +467,125 @@ int CLAppCam::loadFromJson(JsonObject jctx, bool full_set) {
     { 
         ESP_LOGW(tag,"No PWM configured for flash lamp"); 
     }  
+}
+
+int CLAppCam::loadPrefs() {
+    if(esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER && restoreSleepState() == OK) 
+        return OK;
+
+    return CLAppComponent::loadPrefs();
+}
+
+void CLAppCam::saveSleepState() {
+    CamSleepState state;
+    // the padding is a part of the checksum
+    memset(&state, 0, sizeof(state));
+    sleep_state.magic = 0;
+
+    if(!sensor || getLastErr()) return;
+
+    state.magic = CAM_SLEEP_MAGIC;
+    state.prefs_hash = getPrefsHash();
+    state.pid = sensor->id.PID;
+
+    for(size_t i=0; i < properties.size(); i++) {
+        const PropertyDef * prop = properties.at(i);
+        if(!(prop->flags & PROP_LOAD) || prop->type == PROP_STRING || !prop->get) continue;
+        if(state.props_count == CAM_SLEEP_PROPS) {
+            ESP_LOGW(tag, "Too many settings to keep over the sleep");
+            return;
+        }
+        state.props[state.props_count++] = prop->get();
+    }
+
+    // the values the automatic exposure and gain have converged to, the other sensors start from the defaults
+    if(sensor->id.PID == OV2640_PID && sensor->get_reg) {
+        state.regs_valid = true;
+        for(int i=0; i < CAM_SLEEP_REGS; i++) {
+            int val = sensor->get_reg(sensor, ov2640_exposure_regs[i], 0xFF);
+            if(val < 0) {
+                state.regs_valid = false;
+                break;
+            }
+            state.regs[i] = val;
+        }
+    }
+
+    state.adaptive = rateCtl.getConfig();
+    state.lamp = _lampVal;
+    state.flash_lamp = _flashLamp;
+    state.auto_lamp = _autoLamp;
+
+    ESP32PWM * pwm;
+    while(state.pwm_count < CAM_SLEEP_PWMS && (pwm = AppPwm.get(state.pwm_count))) {
+        CamSleepPwm & saved = state.pwm[state.pwm_count++];
+        saved.pin = pwm->getPin();
+        saved.resolution_bits = pwm->getResolutionBits();
+        saved.freq = pwm->getFreq();
+        saved.default_duty = pwm->getDefaultDuty();
+    }
+
+    state.checksum = sleepStateChecksum(state);
+    memcpy(&sleep_state, &state, sizeof(state));
+}
+
+int CLAppCam::restoreSleepState() {
+    const CamSleepState & state = sleep_state;
+    if(state.magic != CAM_SLEEP_MAGIC || state.checksum != sleepStateChecksum(state)) return FAIL;
+    if(!sensor || state.pid != sensor->id.PID) return FAIL;
+
+    // the file is read only if it has been written since its binary copy was made
+    if(state.prefs_hash != readPrefsHash()) {
+        ESP_LOGI(tag, "Preferences changed during the sleep, loading them from the file");
+        return FAIL;
+    }
+
+    size_t n = 0;
+    int failed = 0;
+    for(size_t i=0; i < properties.size(); i++) {
+        const PropertyDef * prop = properties.at(i);
+        if(!(prop->flags & PROP_LOAD) || prop->type == PROP_STRING || !prop->get) continue;
+        if(n == state.props_count) return FAIL;
+
+        // the sensor starts with its defaults, only the settings which differ are written
+        int val = state.props[n++];
+        if(prop->get() != val && properties.setInt(prop, val) != OK) failed++;
+    }
+    if(n != state.props_count) return FAIL;
+    if(failed) ESP_LOGW(tag, "%d camera settings failed to restore", failed);
+
+    // after the settings, which may reset the exposure
+    if(state.regs_valid && sensor->id.PID == OV2640_PID && sensor->set_reg) {
+        for(int i=0; i < CAM_SLEEP_REGS; i++)
+            sensor->set_reg(sensor, ov2640_exposure_regs[i], 0xFF, state.regs[i]);
+    }
+
+    rateCtl.configure(state.adaptive);
+    _lampVal = state.lamp;
+    _flashLamp = state.flash_lamp;
+    _autoLamp = state.auto_lamp;
+
+    for(int i=0; i < state.pwm_count; i++) {
+        const CamSleepPwm & saved = state.pwm[i];
+        ESP32PWM* pwm = AppPwm.attach(saved.pin, saved.freq, saved.resolution_bits);
+        delay(75); // let the PWM settle
+        if(!pwm) {
+            ESP_LOGW(tag,"Failed to attach PWM to pin %d", saved.pin);
+            continue;
+        }
+        if(saved.default_duty) {
+            pwm->setDefaultDuty(saved.default_duty);
+            pwm->reset();
+        }
+    }
+
+    attachLamp();
 
     _imagesServed = 0;
+    setConfigured(true);
+    bumpGeneration();
 
+    ESP_LOGI(tag, "Camera settings restored after the sleep");
     return OK;
 }
 
@@ -162,49 +602,38 @@ void IRAM_ATTR CLAppCam::releaseBuffer() {
     }
 }
 
-int IRAM_ATTR CLAppCam::snapFrame(ProcessFrameCallback sendCallback) {
+CamFrameHandle CLAppCam::getFreshFrame(uint32_t max_age_ms) {
+    if(!max_age_ms || getFrameAge() > max_age_ms * 1000LL) return CamFrameHandle();
+    return getFrame();
+}
 
-    int res = AppCam.snapToBuffer();
+CamFrameHandle CLAppCam::getStillFrame(uint32_t max_age_ms) {
 
-    if(!res) {
+    // serve the latest frame if it is fresh enough
+    CamFrameHandle frame = getFreshFrame(max_age_ms);
+    if(!frame) {
+        // capture latency is recorded by the capture task
+        uint32_t seq = ring.getLatestSeq();
+        requestStill();
 
-        if(isJPEGinBuffer()){
-            res = sendCallback?sendCallback(getBuffer(), getBufferSize()):FAIL;
-        } else {
-            res = FAIL;
+        if(waitFrame(seq, CAM_FRAME_TIMEOUT + CAM_LAMP_SETTLE) != OK) {
+            ESP_LOGW(tag, "Timeout waiting for a frame from the capture task");
+            return CamFrameHandle();
         }
+        frame = getFrame();
     }
 
-    releaseBuffer();
-    return res;
-}
+    if(frame) _imagesServed++;
 
-int CLAppCam::snapStillImage(ProcessFrameCallback sendCallback) {
-
-    if(_lampVal>=0 && _autoLamp){
-        setLamp(_flashLamp);
-        delay(150); // coupled with the status led flash this gives ~150ms for lamp to settle.
-    }
-
-#if (CONFIG_LOG_DEFAULT_LEVEL >= CORE_DEBUG_LEVEL )
-    int64_t fr_start = esp_timer_get_time();
-#endif
-        
-    if (snapFrame(sendCallback) != OK) {
-        if(_autoLamp) setLamp(0);
-        return FAIL;
-    }
-        
-#if (CONFIG_LOG_DEFAULT_LEVEL >= CORE_DEBUG_LEVEL )
-    int64_t fr_end = esp_timer_get_time();
-    ESP_LOGD(tag,"B %ums", (uint32_t)((fr_end - fr_start)/1000));
-#endif
+    return frame;
+}
 
-    if(_autoLamp) setLamp(0);
+int CLAppCam::snapStillImage(ProcessFrameCallback sendCallback, uint32_t max_age_ms) {
 
-    _imagesServed++;
+    CamFrameHandle frame = getStillFrame(max_age_ms);
+    if(!frame) return FAIL;
 
-    return OK;
+    return sendCallback?sendCallback(frame->data.data(), frame->data.size()):FAIL;
 }
 
 // Lamp Control
@@ -213,14 +642,19 @@ void CLAppCam::setLamp(int newVal) {
     if(newVal == DEFAULT_FLASH) {
         newVal = _flashLamp;
     }
+    // the lamp is reported in the status, which is cached per generation of the settings
+    if(newVal != _lampVal) bumpGeneration();
     _lampVal = newVal;
     
+    writeLamp(_lampVal);
+}
+
+void CLAppCam::writeLamp(int val) {
     // Apply a logarithmic function to the scale.
     if(_lamppin) {
-        int brightness = round(_lampVal * _pwmMax/100.00);
+        int brightness = round(val * _pwmMax/100.00);
         AppPwm.write(_lamppin, brightness,0);
     }
-
 }
 
 int CLAppCam::saveToJson(JsonObject jstr, bool full_set) {
@@ -231,48 +665,18 @@ int CLAppCam::saveToJson(JsonObject jstr, bool full_set) {
         return FAIL;
     }
 
-    jstr[FPSTR(CAM_ROTATE)] = myRotation;
-
-    sensor_t * s = esp_camera_sensor_get(); 
-
-    jstr[FPSTR(CAM_PID)] = s->id.PID;
-    jstr[FPSTR(CAM_VER)] = s->id.VER;
-    jstr[FPSTR(CAM_FRAMESIZE)] = s->status.framesize;
-    jstr[FPSTR(CAM_FRAME_RATE)] = frameRate;
+    properties.saveToJson(jstr, full_set);
     
     if(!full_set) return OK;
 
-    jstr[FPSTR(CAM_QUALITY)] = s->status.quality;
-    jstr[FPSTR(CAM_BRIGHTNESS)] = s->status.brightness;
-    jstr[FPSTR(CAM_CONTRAST)] = s->status.contrast;
-    jstr[FPSTR(CAM_SATURATION)] = s->status.saturation;
-    jstr[FPSTR(CAM_SHARPNESS)] = s->status.sharpness;
-    jstr[FPSTR(CAM_DENOISE)] = s->status.denoise;
-    jstr[FPSTR(CAM_SPECIAL_EFFECT)] = s->status.special_effect;
-    jstr[FPSTR(CAM_WB_MODE)] = s->status.wb_mode;
-    jstr[FPSTR(CAM_AWB)] = s->status.awb;
-    jstr[FPSTR(CAM_AWB_GAIN)] = s->status.awb_gain;
-    jstr[FPSTR(CAM_AEC)] = s->status.aec;
-    jstr[FPSTR(CAM_AEC2)] = s->status.aec2;
-    jstr[FPSTR(CAM_AE_LEVEL)] = s->status.ae_level;
-    jstr[FPSTR(CAM_AEC_VALUE)] = s->status.aec_value;
-    jstr[FPSTR(CAM_AGC)] = s->status.agc;
-    jstr[FPSTR(CAM_AGC_GAIN)] = s->status.agc_gain;
-    jstr[FPSTR(CAM_GAINCEILING)] = s->status.gainceiling;
-    jstr[FPSTR(CAM_BPC)] = s->status.bpc;
-    jstr[FPSTR(CAM_WPC)] = s->status.wpc;
-    jstr[FPSTR(CAM_RAW_GMA)] = s->status.raw_gma;
-    jstr[FPSTR(CAM_LENC)] = s->status.lenc;
-    jstr[FPSTR(CAM_VFLIP)] = s->status.vflip;
-    jstr[FPSTR(CAM_HMIRROR)] = s->status.hmirror;
-    jstr[FPSTR(CAM_DCW)] = s->status.dcw;
-    jstr[FPSTR(CAM_COLORBAR)] = s->status.colorbar; 
-
-    jstr[FPSTR(CAM_XCLK)] = xclk;
-
-    jstr[FPSTR(CAM_LAMP)] = getLamp();
-    jstr[FPSTR(CAM_AUTOLAMP)] = isAutoLamp();
-    jstr[FPSTR(CAM_FLASHLAMP)] = getFlashLamp(); 
+    const RateCtlConfig &cfg = rateCtl.getConfig();
+    JsonObject joAdaptive = jstr[FPSTR(CAM_ADAPTIVE)].to<JsonObject>();
+    joAdaptive[FPSTR(CAM_ADAPTIVE_ENABLED)] = cfg.enabled;
+    joAdaptive[FPSTR(CAM_TARGET_FPS)] = cfg.target_fps;
+    joAdaptive[FPSTR(CAM_TARGET_KBPS)] = cfg.target_kbps;
+    joAdaptive[FPSTR(CAM_MAX_QUALITY)] = cfg.max_quality;
+    joAdaptive[FPSTR(CAM_MIN_FRAMESIZE)] = cfg.min_framesize;
+    joAdaptive[FPSTR(CAM_QUALITY_STEP)] = cfg.quality_step;
 
     AppPwm.saveToJson(jstr);
 
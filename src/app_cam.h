@@ -3,14 +3,28 @@
 
 #define DEFAULT_FLASH                   0xFF
 
+// maximum number of tasks waiting for a frame at the same time
+#define CAM_FRAME_WAITERS               4
+
+// notification bits of the capture task
+#define CAM_NOTIFY_FRAME                BIT0    // single frame requested
+#define CAM_NOTIFY_START                BIT1    // continuous capture started
+#define CAM_NOTIFY_DEADLINE             BIT2    // frame deadline of the pacer reached
+#define CAM_NOTIFY_STILL                BIT3    // still image requested, with the flash lamp if enabled
+
 #include <esp_camera.h>
 #include <esp_int_wdt.h>
 #include <esp_task_wdt.h>
+#include <freertos/timers.h>
 #include <ArduinoJson.h>
 
 #include "app_component.h"
 #include "camera_pins.h"
 #include "app_pwm.h"
+#include "frame_ring.h"
+#include "frame_pacer.h"
+#include "latency_stats.h"
+#include "rate_ctl.h"
 
 #include <esp_log.h>
 
@@ -52,9 +66,84 @@ const char CAM_DCW[] PROGMEM = "dcw";
 const char CAM_COLORBAR[] PROGMEM = "colorbar";
 const char CAM_XCLK[] PROGMEM = "xclk";
 
+const char CAM_ADAPTIVE[] PROGMEM = "adaptive";
+const char CAM_ADAPTIVE_ENABLED[] PROGMEM = "enabled";
+const char CAM_TARGET_FPS[] PROGMEM = "target_fps";
+const char CAM_TARGET_KBPS[] PROGMEM = "target_kbps";
+const char CAM_MAX_QUALITY[] PROGMEM = "max_quality";
+const char CAM_MIN_FRAMESIZE[] PROGMEM = "min_framesize";
+const char CAM_QUALITY_STEP[] PROGMEM = "quality_step";
+
+const char CAM_FRAME_JITTER[] PROGMEM = "frame_jitter";
+const char CAM_JITTER_P50[] PROGMEM = "p50";
+const char CAM_JITTER_P90[] PROGMEM = "p90";
+const char CAM_JITTER_P99[] PROGMEM = "p99";
+const char CAM_DEADLINES_SKIPPED[] PROGMEM = "skipped";
+
+// Capture task parameters. The task is pinned to the core not used by the Arduino loop.
+#ifndef CAM_CAPTURE_TASK_CORE
+#define CAM_CAPTURE_TASK_CORE           0
+#endif
+#ifndef CAM_CAPTURE_TASK_PRIORITY
+#define CAM_CAPTURE_TASK_PRIORITY       5
+#endif
+#define CAM_CAPTURE_TASK_STACK          4096
+
+// Maximum time to wait for a fresh frame from the capture task, milliseconds
+#define CAM_FRAME_TIMEOUT               1000
+// time for the flash lamp to settle before a still image is captured, milliseconds
+#define CAM_LAMP_SETTLE                 150
+// time the capture task waits for room in the timer command queue to fan out a frame, milliseconds
+#define CAM_FRAME_PEND_TIMEOUT          10
+
+// State of the camera kept in the RTC slow memory over a timed deep sleep
+#define CAM_SLEEP_MAGIC                 0x43534C50  // "CSLP"
+#define CAM_SLEEP_PROPS                 40          // settings of the property table
+#define CAM_SLEEP_PWMS                  4           // PWM channels, the lamp first
+#define CAM_SLEEP_REGS                  4           // sensor registers of the converged exposure and gain
+
+/**
+ * @brief PWM channel restored after a timed deep sleep
+ *
+ */
+struct CamSleepPwm {
+    uint8_t pin;
+    uint8_t resolution_bits;
+    uint32_t freq;
+    uint32_t default_duty;
+};
+
+/**
+ * @brief Settings applied to the camera and the exposure and gain the sensor has converged to, 
+ * saved before a timed deep sleep. After the wake they are restored without the preference file, 
+ * and the automatic exposure starts from where it was instead of from the defaults of the sensor.
+ */
+struct CamSleepState {
+    uint32_t magic;
+    uint32_t prefs_hash;            // hash of the preference file, the state is dropped if the file has changed
+    uint16_t pid;                   // sensor the state was read from
+    uint8_t props_count;
+    uint8_t pwm_count;
+    int16_t props[CAM_SLEEP_PROPS]; // loadable integer properties of the property table, in the table order
+    uint8_t regs[CAM_SLEEP_REGS];
+    bool regs_valid;
+    RateCtlConfig adaptive;
+    int16_t lamp;
+    int16_t flash_lamp;
+    bool auto_lamp;
+    CamSleepPwm pwm[CAM_SLEEP_PWMS];
+    uint32_t checksum;              // of the fields above
+};
+
 // Callback type for binary data transmission
 typedef int (*ProcessFrameCallback)(uint8_t* buffer, size_t size);
 
+// Handler of the frames published by the continuous capture, called in the timer service task 
+// with the sequence number of the frame
+typedef PendedFunction_t FrameReadyHandler;
+
+void captureTask(void * pvParameters);
+
 /**
  * @brief Camera Manager
  * Manages all interactions with camera
@@ -70,6 +159,18 @@ class CLAppCam : public CLAppComponent {
         int loadFromJson(JsonObject jstr, bool full_set = true);
         int saveToJson(JsonObject jstr, bool full_set = true);
 
+        // on the wake from a timed deep sleep the settings are restored from the RTC memory
+        int loadPrefs();
+
+        /// @brief keeps the applied settings and the converged exposure in the RTC memory, called before a timed deep sleep
+        void saveSleepState();
+
+        /// @brief applies the settings kept by saveSleepState(), if the preference file hasn't changed since
+        /// @return OK(0) or FAIL(1) if there is no valid state
+        int restoreSleepState();
+
+        CLPropertyRegistry * getProperties() {return &properties;};
+
         int getSensorPID() {return (sensor?sensor->id.PID:0);};
         sensor_t * getSensor() {return sensor;};
         String getErr() {return critERR;};
@@ -77,15 +178,69 @@ class CLAppCam : public CLAppComponent {
         int getFrameRate() {return frameRate;};
         void setFrameRate(int newFrameRate) {frameRate = newFrameRate;};
 
+        // rate of the continuous capture; never above the configured frame rate
+        int getCaptureRate() {return (_captureRate > 0 && _captureRate < frameRate?_captureRate:(frameRate>0?frameRate:1));};
+        void setCaptureRate(int rate) {_captureRate = rate;};
+
         void setXclk(int val) {xclk = val;};
         int getXclk() {return xclk;};
 
         void setRotation(int val) {myRotation = val;};
         int getRotation() {return myRotation;};
 
-        int IRAM_ATTR snapFrame(ProcessFrameCallback sendCallback);
+        // continuous capture into the frame ring, while at least one consumer is registered
+        void startCapture();
+        void stopCapture();
+        bool isCapturing() {return _captureClients > 0;};
+
+        // adaptive stream mode
+        bool isAdaptive() {return rateCtl.isEnabled();};
+        void setAdaptive(bool val);
+
+        // while the adaptive stream is running, the settings it was started with are reported
+        int getFramesize();
+        int setFramesize(int val);
+        int getQuality();
+        int setQuality(int val);
 
-        int snapStillImage(ProcessFrameCallback sendCallback);
+        /// @brief feeds the stream statistics of the last interval to the adaptive controller
+        /// and applies the new quality / framesize to the sensor if they have changed
+        void adaptStream(uint32_t frames, uint32_t bytes, uint32_t dropped, uint32_t interval_ms);
+
+        // handler called after each frame is published, or with the sequence 0 after a failed capture
+        void setFrameHandler(FrameReadyHandler handler) {_frameHandler = handler;};
+
+        // request a single frame from the capture task
+        void requestFrame();
+        // request a still image from the capture task; the flash lamp is lit by the task if enabled.
+        // While capturing continuously, the request is served by the next frame
+        void requestStill();
+
+        /// @brief waits until a frame newer than after_seq is published in the ring.
+        /// The waiting task is woken by its task notification.
+        /// @return OK(0) or FAIL(1) on timeout
+        int waitFrame(uint32_t after_seq, uint32_t timeout_ms = CAM_FRAME_TIMEOUT);
+
+        // handle to the latest frame in the ring; the slot is reused once all copies of the handle are gone
+        CamFrameHandle IRAM_ATTR getFrame() {return ring.acquire();};
+        uint32_t getFrameSeq() {return ring.getLatestSeq();};
+        // age of the latest frame in microseconds
+        int64_t getFrameAge() {return (ring.getLatestSeq()?esp_timer_get_time() - ring.getLatestTimestamp():INT64_MAX);};
+
+        // capture task loop
+        void IRAM_ATTR captureLoop();
+
+        // the latest frame if it is not older than max_age_ms, empty otherwise
+        CamFrameHandle getFreshFrame(uint32_t max_age_ms);
+
+        /// @brief returns a still image. The latest captured frame is reused if it is not older than 
+        /// max_age_ms, otherwise a new frame is captured (with the flash lamp if enabled).
+        /// Waits for the capture, so it is not to be called from the network task
+        /// @param max_age_ms maximum age of the latest frame to be reused, 0 to always capture a new one
+        /// @return handle to the frame, empty on failure
+        CamFrameHandle getStillFrame(uint32_t max_age_ms = 0);
+
+        int snapStillImage(ProcessFrameCallback sendCallback, uint32_t max_age_ms = 0);
 
         void setAutoLamp(bool val) {_autoLamp = val;};
         bool isAutoLamp() { return _autoLamp;};   
@@ -96,13 +251,28 @@ class CLAppCam : public CLAppComponent {
         int getLamp() {return _lampVal;};   
         
         long getImagesServed() {return _imagesServed;};
+        void imageServed() {_imagesServed++;};
+        uint32_t getFramesCaptured() {return _framesCaptured;};
+        uint32_t getCaptureErrors() {return _captureErrors;};
+        uint32_t getFramesDropped() {return ring.getDropped();};
+
+        // inter-frame jitter percentile of the continuous capture, microseconds
+        uint32_t getFrameJitter(int pct) {return pacer.getJitter(pct);};
+        uint32_t getDeadlinesSkipped() {return pacer.getSkipped();};
     
     protected:
         int IRAM_ATTR snapToBuffer();
         void IRAM_ATTR releaseBuffer(); 
+        // takes the first PWM channel as the lamp
+        void attachLamp();
+        // drives the lamp without changing its setting, e.g. for the flash of a still
+        void writeLamp(int val);
+
         bool IRAM_ATTR isJPEGinBuffer() {return (fb?fb->format == PIXFORMAT_JPEG:false);};
         uint8_t * IRAM_ATTR getBuffer() {return (fb?fb->buf:nullptr);};
         size_t IRAM_ATTR getBufferSize() {return (fb?fb->len:0);};
+        // capture time of the frame set by the camera driver, microseconds since boot
+        int64_t IRAM_ATTR getBufferTimestamp() {return (fb?fb->timestamp.tv_sec * 1000000LL + fb->timestamp.tv_usec:0);};
 
     private:
         // Camera config structure
@@ -117,6 +287,9 @@ class CLAppCam : public CLAppComponent {
         // frame rate in FPS
         int frameRate = 25;
 
+        // rate of the continuous capture requested by the stream clients, 0 for the frame rate
+        int _captureRate = 0;
+
         // Flash LED lamp parameters.
         // should be defined in the 1st line of the pwm collection in the cam prefs (cam.json)
         bool _autoLamp = false;         // Automatic lamp (auto on while camera running)
@@ -141,6 +314,35 @@ class CLAppCam : public CLAppComponent {
 
         long _imagesServed;
 
+        // ring of captured frames shared by the consumers
+        CLFrameRing ring;
+
+        // deadline scheduler of the continuous capture
+        CLFramePacer pacer;
+
+        FrameReadyHandler _frameHandler = NULL;
+
+        TaskHandle_t _capture_task = NULL;
+        // tasks blocked in waitFrame(); a task checks the sequence and registers itself atomically,
+        // so a frame published in between can't be missed
+        TaskHandle_t _frame_waiters[CAM_FRAME_WAITERS] = {NULL};
+        portMUX_TYPE _waiters_lock = portMUX_INITIALIZER_UNLOCKED;
+
+        // wakes the tasks waiting for a frame
+        void notifyWaiters();
+
+        // number of consumers requiring continuous capture
+        volatile int _captureClients = 0;
+
+        // adaptive JPEG quality / framesize controller for streaming
+        CLRateController rateCtl;
+
+        // camera and sensor settings
+        CLPropertyRegistry properties;
+
+        uint32_t _framesCaptured = 0;
+        uint32_t _captureErrors = 0;
+
 };
 
 extern CLAppCam AppCam;
@@ -1,10 +1,35 @@
 #include "app_component.h"
 
+#include <Preferences.h>
+
+// hashes the serialized document the same way as prefsHash(), without a buffer
+struct PrefsHashWriter {
+    uint32_t hash;
+
+    size_t write(uint8_t c) {
+        hash = (hash ^ c) * 16777619u;
+        return 1;
+    }
+
+    size_t write(const uint8_t * data, size_t len) {
+        for(size_t i=0; i < len; i++) hash = (hash ^ data[i]) * 16777619u;
+        return len;
+    }
+};
+
 char * CLAppComponent::getPrefsFileName(bool forsave) {
     if(tag) {
         snprintf(prefs, TAG_LENGTH, "/%s.json", tag);
         if(Storage.exists(prefs) || forsave)
             return prefs;
+
+        // a save interrupted after the old file was removed and before the new one was renamed (SPIFFS, SD)
+        char tmp_file[TAG_LENGTH + sizeof(PREFS_TMP_SUFFIX)];
+        snprintf(tmp_file, sizeof(tmp_file), "%s" PREFS_TMP_SUFFIX, prefs);
+        if(Storage.exists(tmp_file) && Storage.rename(tmp_file, prefs)) {
+            ESP_LOGW(tag, "Recovered %s from an interrupted save", prefs);
+            return prefs;
+        }
         else {
             ESP_LOGW(tag, "Pref file %s not found, falling back to default", prefs);
             if(prefix)
@@ -20,15 +45,25 @@ char * CLAppComponent::getPrefsFileName(bool forsave) {
 
 void CLAppComponent::dumpPrefs() {
     char *prefs_file = getPrefsFileName(); 
-    String s;
-    if(Storage.readFileToString(prefs_file, &s) != OK) {
+    CachedFile file = Storage.readFile(prefs_file);
+    if(!file) {
         ESP_LOGE(tag,"Preference file %s not found.", prefs_file);
         return;
     }
-    Serial.println(s);
+    Serial.write(file->data, file->size);
+    Serial.println();
 }
 
 int CLAppComponent::removePrefs() {
+  // drop the preferences waiting to be written, they would bring the file back
+  if(_prefs_mutex) {
+    xSemaphoreTake(_prefs_mutex, portMAX_DELAY);
+    _pending = false;
+    _pending_doc.clear();
+    xSemaphoreGive(_prefs_mutex);
+  }
+  _saved_hash = 0;
+
   char *prefs_file = getPrefsFileName(true);  
   if (Storage.exists(prefs_file)) {
     ESP_LOGI(tag, "Removing %s\r\n", prefs_file);
@@ -39,6 +74,7 @@ int CLAppComponent::removePrefs() {
   } else {
     ESP_LOGW(tag,"No saved %s preferences to remove", tag);
   }
+  removePrefsBlob();
   return OK;
 }
 
@@ -49,7 +85,10 @@ int CLAppComponent::loadPrefs() {
         return ret;
     }
  
-    return loadFromJson(jdoc.as<JsonObject>());
+    ret = loadFromJson(jdoc.as<JsonObject>());
+    bumpGeneration();
+
+    return ret;
 }
 
 int CLAppComponent::savePrefs(){
@@ -61,45 +100,312 @@ int CLAppComponent::savePrefs(){
         return res;
     }
 
-    return savePrefsToFile(&doc);
+    return schedulePrefs(&doc);
 }
 
 int CLAppComponent::parsePrefs(JsonDocument *doc) {
   char *pref_file = getPrefsFileName(); 
 
-  File pref_json = Storage.open(pref_file);
+  // the binary copy made from a file of the same name, size and modification time is used without reading the file
+  uint32_t source_stamp = prefsStamp(pref_file);
+  uint32_t source_hash = 0;
+  if(source_stamp && loadPrefsBlob(doc, source_stamp, &source_hash) == OK) {
+      _saved_hash = source_hash;
+      configured = true;
+      return OK;
+  }
+
+  // the file is read in blocks, the parser doesn't call the file system for each character
+  CachedFile pref_json = Storage.readFile(pref_file);
 
   if(!pref_json) {
       ESP_LOGE(tag, "Failed to open settings from %s", pref_file);
       return FAIL;
   }
 
-  DeserializationError ret = deserializeJson(*doc, pref_json);
+  // the JSON file is parsed only if its contents have changed since it was converted to the binary copy
+  source_hash = prefsHash(pref_file, pref_json->data, pref_json->size);
+  _saved_hash = source_hash;
+  if(loadPrefsBlob(doc, 0, &source_hash) == OK) {
+      // only the time has changed, the next boot takes the fast path again
+      savePrefsBlob(doc, source_hash, source_stamp);
+      configured = true;
+      return OK;
+  }
+
+  DeserializationError ret = deserializeJson(*doc, (const char*)pref_json->data, pref_json->size);
 
   if(ret != DeserializationError::Ok) {
       ESP_LOGW(tag,"Preference file %s could not be parsed; using system defaults.", pref_file);
       return FAIL;
   }
 
+  savePrefsBlob(doc, source_hash, source_stamp);
+
   configured = true;
 
   return OK;
 }
 
+uint32_t CLAppComponent::readPrefsHash() {
+  char *pref_file = getPrefsFileName();
+
+  uint32_t source_stamp = prefsStamp(pref_file);
+  uint32_t source_hash = 0;
+  if(source_stamp && loadPrefsBlob(nullptr, source_stamp, &source_hash) == OK) {
+    _saved_hash = source_hash;
+    return _saved_hash;
+  }
+
+  CachedFile pref_json = Storage.readFile(pref_file);
+  _saved_hash = (pref_json?prefsHash(pref_file, pref_json->data, pref_json->size):0);
+  return _saved_hash;
+}
+
 int CLAppComponent::savePrefsToFile(JsonDocument *doc) {
     char * prefs_file = getPrefsFileName(true); 
+    char tmp_file[TAG_LENGTH + sizeof(PREFS_TMP_SUFFIX)];
+    snprintf(tmp_file, sizeof(tmp_file), "%s" PREFS_TMP_SUFFIX, prefs_file);
 
-    File file = Storage.open(prefs_file, FILE_WRITE);
-    if(file) {
-        ESP_LOGI(tag,"Saving preferences to file %s", prefs_file);
-        serializeJson(*doc, file);
-        file.close();
-        return OK;
+    size_t len = measureJson(*doc);
+    char * buffer = (char*) malloc(len + 1);
+    if(!buffer) {
+        ESP_LOGE(tag, "No memory to save preferences (%d bytes)", (int)len);
+        return FAIL;
     }
-    else {
+    serializeJson(*doc, buffer, len + 1);
+
+    // the live file is replaced only by a complete copy, so a reset during the write doesn't corrupt it
+    File file = Storage.open(tmp_file, FILE_WRITE);
+    if(!file) {
+        free(buffer);
+        ESP_LOGW(tag,"Failed to save preferences to file %s", tmp_file);
+        return FAIL;
+    }
+
+    ESP_LOGI(tag,"Saving preferences to file %s", prefs_file);
+    size_t written = file.write((const uint8_t*)buffer, len);
+    // File::flush() is only an fflush(); there is no page cache under the VFS, and closing the file makes 
+    // LittleFS, SPIFFS and FAT write out their own caches and the size, before the file is renamed
+    file.close();
+
+    if(written != len || !Storage.rename(tmp_file, prefs_file)) {
+        free(buffer);
+        Storage.remove(tmp_file);
         ESP_LOGW(tag,"Failed to save preferences to file %s", prefs_file);
         return FAIL;
     }
+
+    // the binary copy is valid for the file just written, so the next boot doesn't parse it
+    _saved_hash = prefsHash(prefs_file, (const uint8_t*)buffer, len);
+    savePrefsBlob(doc, _saved_hash, prefsStamp(prefs_file));
+    free(buffer);
+    return OK;
+}
+
+int CLAppComponent::schedulePrefs(JsonDocument *doc) {
+    // created on the first save; the saves come from the web server task
+    if(!_prefs_mutex) {
+        _prefs_mutex = xSemaphoreCreateMutex();
+        if(!_prefs_mutex) return savePrefsToFile(doc);
+    }
+
+    xSemaphoreTake(_prefs_mutex, portMAX_DELAY);
+
+    PrefsHashWriter writer = {propertyHash(getPrefsFileName(true))};
+    serializeJson(*doc, writer);
+
+    // the file has the same contents already; changes waiting to be written have been reverted
+    if(writer.hash == _saved_hash) {
+        _pending = false;
+        _pending_doc.clear();
+        xSemaphoreGive(_prefs_mutex);
+        ESP_LOGD(tag, "Preferences unchanged, not saved");
+        return OK;
+    }
+
+    if(!_pending) {
+        int i = 0;
+        while(i < MAX_PREFS_WRITERS && _writers[i] && _writers[i] != this) i++;
+        if(i == MAX_PREFS_WRITERS) {
+            xSemaphoreGive(_prefs_mutex);
+            ESP_LOGW(tag, "Too many components with pending preferences, saving now");
+            return savePrefsToFile(doc);
+        }
+        _writers[i] = this;
+        _pending_since = millis();
+        _pending = true;
+    }
+    _pending_doc = *doc;
+    _pending_hash = writer.hash;
+
+    if(!_prefs_task && xTaskCreate(prefsWriteTask, "prefs", PREFS_WRITE_TASK_STACK, nullptr, 
+                                   PREFS_WRITE_TASK_PRIORITY, &_prefs_task) != pdPASS) {
+        _prefs_task = NULL;
+        xSemaphoreGive(_prefs_mutex);
+        writePending(true);
+        return OK;
+    }
+
+    xSemaphoreGive(_prefs_mutex);
+    xTaskNotifyGive(_prefs_task);
+    return OK;
+}
+
+void CLAppComponent::flushPrefs() {
+    writePending(true);
+}
+
+void CLAppComponent::writePending(bool all) {
+    if(!_prefs_mutex) return;
+
+    xSemaphoreTake(_prefs_mutex, portMAX_DELAY);
+    for(int i=0; i < MAX_PREFS_WRITERS && _writers[i]; i++) {
+        CLAppComponent * component = _writers[i];
+        if(!component->_pending) continue;
+        if(!all && millis() - component->_pending_since < PREFS_WRITE_DELAY) continue;
+
+        component->savePrefsToFile(&component->_pending_doc);
+        component->_pending = false;
+        component->_pending_doc.clear();
+    }
+    xSemaphoreGive(_prefs_mutex);
+}
+
+void CLAppComponent::prefsWriteTask(void * arg) {
+    while(true) {
+        // sleeps until a save, then until the oldest pending change is due
+        TickType_t wait = portMAX_DELAY;
+        uint32_t now = millis();
+
+        xSemaphoreTake(_prefs_mutex, portMAX_DELAY);
+        for(int i=0; i < MAX_PREFS_WRITERS && _writers[i]; i++) {
+            if(!_writers[i]->_pending) continue;
+            uint32_t elapsed = now - _writers[i]->_pending_since;
+            TickType_t due = pdMS_TO_TICKS(elapsed < PREFS_WRITE_DELAY?PREFS_WRITE_DELAY - elapsed:0);
+            if(due < wait) wait = due;
+        }
+        xSemaphoreGive(_prefs_mutex);
+
+        if(wait) ulTaskNotifyTake(pdTRUE, wait);
+        writePending(false);
+    }
+}
+
+int CLAppComponent::loadPrefsBlob(JsonDocument *doc, uint32_t source_stamp, uint32_t * source_hash) {
+    if(!tag) return FAIL;
+
+    Preferences nvs;
+    if(!nvs.begin(PREFS_BLOB_NS, true)) return FAIL;
+
+    size_t len = nvs.getBytesLength(tag);
+    if(len < sizeof(PrefsBlobHeader)) {
+        nvs.end();
+        return FAIL;
+    }
+
+    uint8_t * blob = (uint8_t*) malloc(len);
+    if(!blob) {
+        nvs.end();
+        return FAIL;
+    }
+
+    size_t read = nvs.getBytes(tag, blob, len);
+    nvs.end();
+
+    PrefsBlobHeader header;
+    memcpy(&header, blob, sizeof(header));
+    bool valid = (read == len && header.magic == PREFS_BLOB_MAGIC && header.version == PREFS_BLOB_VERSION &&
+                  header.len == len - sizeof(header));
+    if(!valid || (source_stamp?header.source_stamp != source_stamp:header.source_hash != *source_hash)) {
+        free(blob);
+        // a changed stamp is checked against the contents of the file next
+        if(!source_stamp) ESP_LOGI(tag, "Binary preferences are stale, converting the JSON file");
+        return FAIL;
+    }
+    *source_hash = header.source_hash;
+
+    if(!doc) {
+        free(blob);
+        return OK;
+    }
+
+    DeserializationError ret = deserializeMsgPack(*doc, (const char*)blob + sizeof(header), header.len);
+    free(blob);
+
+    if(ret != DeserializationError::Ok) {
+        ESP_LOGW(tag, "Binary preferences could not be decoded: %s", ret.c_str());
+        doc->clear();
+        return FAIL;
+    }
+
+    return OK;
+}
+
+int CLAppComponent::savePrefsBlob(JsonDocument *doc, uint32_t source_hash, uint32_t source_stamp) {
+    if(!tag) return FAIL;
+
+    size_t len = measureMsgPack(*doc);
+    if(len > UINT16_MAX) {
+        ESP_LOGW(tag, "Preferences too big for the binary copy (%d bytes)", (int)len);
+        removePrefsBlob();
+        return FAIL;
+    }
+
+    uint8_t * blob = (uint8_t*) malloc(sizeof(PrefsBlobHeader) + len);
+    if(!blob) return FAIL;
+
+    PrefsBlobHeader header = {PREFS_BLOB_MAGIC, PREFS_BLOB_VERSION, (uint16_t)len, source_hash, source_stamp};
+    memcpy(blob, &header, sizeof(header));
+    serializeMsgPack(*doc, blob + sizeof(header), len);
+
+    Preferences nvs;
+    size_t written = 0;
+    if(nvs.begin(PREFS_BLOB_NS, false)) {
+        written = nvs.putBytes(tag, blob, sizeof(header) + len);
+        nvs.end();
+    }
+    free(blob);
+
+    if(written != sizeof(header) + len) {
+        ESP_LOGW(tag, "Failed to save the binary preferences");
+        return FAIL;
+    }
+    return OK;
+}
+
+void CLAppComponent::removePrefsBlob() {
+    if(!tag) return;
+
+    Preferences nvs;
+    if(nvs.begin(PREFS_BLOB_NS, false)) {
+        if(nvs.isKey(tag)) nvs.remove(tag);
+        nvs.end();
+    }
+}
+
+uint32_t CLAppComponent::prefsHash(const char * path, const uint8_t * data, size_t len) {
+    // FNV-1a over the name, so a fallback to the default file is not taken for the saved one
+    PrefsHashWriter writer = {propertyHash(path)};
+    writer.write(data, len);
+    return writer.hash;
+}
+
+uint32_t CLAppComponent::prefsStamp(const char * path) {
+    File file = Storage.open(path);
+    if(!file) return 0;
+
+    uint32_t size = file.size();
+    uint32_t mtime = file.getLastWrite();
+    file.close();
+
+    // without the times a rewrite of the same size would go unnoticed
+    if(!mtime) return 0;
+
+    PrefsHashWriter writer = {propertyHash(path)};
+    writer.write((const uint8_t*)&size, sizeof(size));
+    writer.write((const uint8_t*)&mtime, sizeof(mtime));
+    return (writer.hash?writer.hash:1);
 }
 
 int CLAppComponent::urlDecode(char * decoded, char * source, size_t len) {
@@ -162,4 +468,9 @@ int CLAppComponent::urlEncode(char * encoded, char * source, size_t len) {
   }
   *ptr = '\0';
   return OK;
-}
\ No newline at end of file
+}
+
+uint32_t CLAppComponent::_generation = 1;
+CLAppComponent * CLAppComponent::_writers[MAX_PREFS_WRITERS] = {nullptr};
+SemaphoreHandle_t CLAppComponent::_prefs_mutex = NULL;
+TaskHandle_t CLAppComponent::_prefs_task = NULL;
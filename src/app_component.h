@@ -10,11 +10,43 @@
 #endif
 
 #include "storage.h"
+#include "app_property.h"
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include <esp_log.h>
 
 #define TAG_LENGTH 32
 
+// the preference file is written to a temporary file, which then replaces it
+#define PREFS_TMP_SUFFIX        ".tmp"
+
+// preferences saved within this time after the first change are written together, ms
+#ifndef PREFS_WRITE_DELAY
+#define PREFS_WRITE_DELAY       2000
+#endif
+#define MAX_PREFS_WRITERS       8
+#define PREFS_WRITE_TASK_PRIORITY 1
+#define PREFS_WRITE_TASK_STACK  4096
+
+// NVS namespace of the binary copies of the preference files, one entry per component tag
+#define PREFS_BLOB_NS           "prefs"
+#define PREFS_BLOB_MAGIC        0x42465250  // "PRFB"
+// bump when the way the components read their settings changes, to convert the JSON files again
+#define PREFS_BLOB_VERSION      2
+
+/**
+ * @brief Header of the binary copy of a preference file. The payload is the document of the file
+ * encoded as MessagePack.
+ */
+struct PrefsBlobHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t len;           // length of the payload
+    uint32_t source_hash;   // hash of the name and the contents of the JSON file it was converted from
+    uint32_t source_stamp;  // hash of the name, size and modification time of that file, see prefsStamp()
+};
+
 /**
  * @brief Abstract root class for the application components.
  * 
@@ -29,9 +61,15 @@ class CLAppComponent {
 
         virtual int loadFromJson(JsonObject jctx, bool full_set = true) { return OK; };
         virtual int saveToJson(JsonObject jctx, bool full_set = true) { return OK; };
+
+        // settings of the component which can be changed at runtime, nullptr if there are none
+        virtual CLPropertyRegistry * getProperties() { return nullptr; };
         
         virtual void dumpPrefs();
         virtual int removePrefs();
+
+        /// @brief writes the preferences waiting for the write-behind task right away, e.g. before a reboot
+        static void flushPrefs();
         
         char * getPrefsFileName(bool forsave = false);
 
@@ -41,6 +79,11 @@ class CLAppComponent {
 
         const char* getTag() {return tag;};
 
+        // generation of the application settings, bumped on every change; used to cache the status responses.
+        // Bumped by the capture task as well (the auto lamp), so the increment is atomic
+        static uint32_t getGeneration() {return __atomic_load_n(&_generation, __ATOMIC_RELAXED);};
+        static void bumpGeneration() {__atomic_add_fetch(&_generation, 1, __ATOMIC_RELAXED);};
+
     protected:
         // prefix for forming preference file name of this class
         const char * tag;   
@@ -51,10 +94,48 @@ class CLAppComponent {
 
         void setErr(int err_code) {last_err = err_code;};
 
+        // for the components restoring their settings without the preference file
+        void setConfigured(bool val) {configured = val;};
+
+        // hash of the preference file as last read or written, 0 if there is none
+        uint32_t getPrefsHash() {return _saved_hash;};
+
+        /// @brief hash of the preference file to compare it with the hash of the file the settings came from.
+        /// The file is read only if it has changed since its binary copy was made. 
+        /// The hash is kept as the one of the file last read.
+        /// @return hash of the preference file, see prefsHash(), 0 if it can't be read
+        uint32_t readPrefsHash();
+
         int parsePrefs(JsonDocument *jctx);
 
+        /// @brief writes the preferences to the file right away, through a temporary file
+        /// @return OK(0) or FAIL(1)
         int savePrefsToFile(JsonDocument *jctx);
 
+        /// @brief queues the preferences for the write-behind task, unless they match the saved file
+        /// @return OK(0) or FAIL(1)
+        int schedulePrefs(JsonDocument *jctx);
+
+        /// @brief reads the binary copy of the preferences, if it was converted from the JSON file 
+        /// of the stamp or, if the stamp is 0, of the hash
+        /// @param doc decoded document, nullptr to check the copy only
+        /// @param source_hash hash of the file; set to the hash of the file the copy was made from
+        /// @return OK(0) or FAIL(1) if there is none, it is stale or can't be decoded
+        int loadPrefsBlob(JsonDocument *doc, uint32_t source_stamp, uint32_t * source_hash);
+
+        /// @brief stores the document in the binary copy of the preferences
+        /// @return OK(0) or FAIL(1)
+        int savePrefsBlob(JsonDocument *doc, uint32_t source_hash, uint32_t source_stamp);
+
+        void removePrefsBlob();
+
+        static uint32_t prefsHash(const char * path, const uint8_t * data, size_t len);
+
+        /// @brief hash of the name, size and modification time of a file, like the file cache checks it; 
+        /// the file is not read
+        /// @return the stamp or 0 if the file is missing or the file system doesn't keep the times
+        static uint32_t prefsStamp(const char * path);
+
         int urlDecode(char * decoded, char * source, size_t len); 
         int urlEncode(char * encoded, char * source, size_t len);
 
@@ -68,6 +149,26 @@ class CLAppComponent {
         bool configured = false;
 
         char prefs[TAG_LENGTH] = "prefs.json";
+
+        static uint32_t _generation;
+
+        // hash of the preference file as last read or written, see prefsHash()
+        uint32_t _saved_hash = 0;
+
+        // preferences waiting to be written, and the time of the first change since the last write
+        JsonDocument _pending_doc;
+        bool _pending = false;
+        uint32_t _pending_hash = 0;
+        uint32_t _pending_since = 0;
+
+        static void prefsWriteTask(void * arg);
+        // writes the pending preferences of the components, all of them or only those due
+        static void writePending(bool all);
+
+        static CLAppComponent * _writers[MAX_PREFS_WRITERS];
+        // guards the pending preferences; held while they are written, so a save waits for a write in progress
+        static SemaphoreHandle_t _prefs_mutex;
+        static TaskHandle_t _prefs_task;
 };
 
 #endif
\ No newline at end of file
@@ -61,6 +61,16 @@
 // #define ENABLE_MAIL_FEATURE 
 
 
+/*
+ * Web UI compiled into the firmware
+ *
+ * Uncomment the line below to serve the pages and the static assets from the flash instead of the file system.
+ * The assets are generated into src/embedded_assets.h by scripts/gzip_assets.py, which PlatformIO runs 
+ * with each build; with the Arduino IDE, run "python scripts/gzip_assets.py data --embed src/embedded_assets.h".
+ */
+// #define ENABLE_EMBEDDED_ASSETS
+
+
 /*
 * Commands to an external device over UART
 */
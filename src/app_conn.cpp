@@ -1,6 +1,97 @@
 #include "app_conn.h"
 
-CLAppConn::CLAppConn() {
+static int conn_set_ssid(const char * val) {
+    // a new network needs its own password
+    AppConn.setSSID(val); 
+    AppConn.setPassword(""); 
+    return OK;
+}
+static const char * conn_get_ssid() {return AppConn.getSSID();}
+static int conn_set_password(const char * val) {AppConn.setPassword(val); return OK;}
+
+static const char * ipToString(IPAddress * ip) {
+    static char buf[16];
+    if(!ip) return "";
+    snprintf(buf, sizeof(buf), "%s", ip->toString().c_str());
+    return buf;
+}
+
+static int conn_set_st_ip(const char * val) {return AppConn.setStaticIP(&(AppConn.getStaticIP()->ip), val);}
+static const char * conn_get_st_ip() {return ipToString(AppConn.getStaticIP()->ip);}
+static int conn_set_st_subnet(const char * val) {return AppConn.setStaticIP(&(AppConn.getStaticIP()->netmask), val);}
+static const char * conn_get_st_subnet() {return ipToString(AppConn.getStaticIP()->netmask);}
+static int conn_set_st_gateway(const char * val) {return AppConn.setStaticIP(&(AppConn.getStaticIP()->gateway), val);}
+static const char * conn_get_st_gateway() {return ipToString(AppConn.getStaticIP()->gateway);}
+static int conn_set_dns1(const char * val) {return AppConn.setStaticIP(&(AppConn.getStaticIP()->dns1), val);}
+static const char * conn_get_dns1() {return ipToString(AppConn.getStaticIP()->dns1);}
+static int conn_set_dns2(const char * val) {return AppConn.setStaticIP(&(AppConn.getStaticIP()->dns2), val);}
+static const char * conn_get_dns2() {return ipToString(AppConn.getStaticIP()->dns2);}
+static int conn_set_ap_ip(const char * val) {return AppConn.setStaticIP(&(AppConn.getAPIP()->ip), val);}
+static const char * conn_get_ap_ip() {return ipToString(AppConn.getAPIP()->ip);}
+static int conn_set_ap_subnet(const char * val) {return AppConn.setStaticIP(&(AppConn.getAPIP()->netmask), val);}
+static const char * conn_get_ap_subnet() {return ipToString(AppConn.getAPIP()->netmask);}
+
+static int conn_set_ap_ssid(const char * val) {AppConn.setApName(val); return OK;}
+static int conn_set_ap_pass(const char * val) {AppConn.setApPass(val); return OK;}
+static int conn_set_mdns_name(const char * val) {AppConn.setMDNSName(val); return OK;}
+static const char * conn_get_mdns_name() {return AppConn.getMDNSname();}
+static int conn_set_ntp_server(const char * val) {AppConn.setNTPServer(val); return OK;}
+static const char * conn_get_ntp_server() {return AppConn.getNTPServer();}
+static int conn_set_user(const char * val) {AppConn.setUser(val); return OK;}
+static const char * conn_get_user() {return AppConn.getUser();}
+static int conn_set_pwd(const char * val) {AppConn.setPwd(val); return OK;}
+static int conn_set_ota_password(const char * val) {AppConn.setOTAPassword(val); return OK;}
+
+static int conn_set_load_as_ap(int val) {AppConn.setLoadAsAP(val); return OK;}
+static int conn_set_ap_timeout(int val) {AppConn.setAPTimeout(val); return OK;}
+static int conn_get_ap_timeout() {return AppConn.getAPTimeout();}
+static int conn_set_ap_channel(int val) {AppConn.setAPChannel(val); return OK;}
+static int conn_get_ap_channel() {return AppConn.getAPChannel();}
+static int conn_set_ap_dhcp(int val) {AppConn.setAPDHCP(val); return OK;}
+static int conn_get_ap_dhcp() {return AppConn.isAPDHCP();}
+static int conn_set_dhcp(int val) {AppConn.setDHCPEnabled(val); return OK;}
+static int conn_get_dhcp() {return AppConn.isDHCPEnabled();}
+static int conn_set_http_port(int val) {AppConn.setHTTPPort(val); return OK;}
+static int conn_get_http_port() {return AppConn.getHTTPPort();}
+static int conn_set_ota_enabled(int val) {AppConn.setOTAEnabled(val); return OK;}
+static int conn_get_ota_enabled() {return AppConn.isOTAEnabled();}
+static int conn_set_gmt_offset(int val) {AppConn.setGmtOffset_sec(val); return OK;}
+static int conn_get_gmt_offset() {return AppConn.getGmtOffset_sec();}
+static int conn_set_dst_offset(int val) {AppConn.setDaylightOffset_sec(val); return OK;}
+static int conn_get_dst_offset() {return AppConn.getDaylightOffset_sec();}
+
+// Properties of the connection. The registry saves the configured values for the system status only; 
+// the preferences keep their own format, with the known stations and the static IP as nested objects.
+// The passwords are write-only, the AP mode reported in the status is the actual one (see dumpSystemStatusToJson()).
+static constexpr PropertyDef conn_properties[] = {
+    strProperty(CONN_SSID, PROP_SAVE, conn_set_ssid, conn_get_ssid),
+    strProperty(CONN_PASSWORD, 0, conn_set_password, nullptr),
+    boolProperty(CONN_DHCP, PROP_SAVE, conn_set_dhcp, conn_get_dhcp),
+    strProperty(CONN_ST_IP, PROP_SAVE, conn_set_st_ip, conn_get_st_ip),
+    strProperty(CONN_ST_SUBNET, PROP_SAVE, conn_set_st_subnet, conn_get_st_subnet),
+    strProperty(CONN_ST_GATEWAY, PROP_SAVE, conn_set_st_gateway, conn_get_st_gateway),
+    strProperty(CONN_DNS1, PROP_SAVE, conn_set_dns1, conn_get_dns1),
+    strProperty(CONN_DNS2, PROP_SAVE, conn_set_dns2, conn_get_dns2),
+    boolProperty(CONN_LOAD_AS_AP, 0, conn_set_load_as_ap, nullptr),
+    intProperty(CONN_AP_TIMEOUT, 0, INT32_MAX, PROP_SAVE, conn_set_ap_timeout, conn_get_ap_timeout),
+    strProperty(CONN_AP_SSID, 0, conn_set_ap_ssid, nullptr),
+    strProperty(CONN_AP_PASS, 0, conn_set_ap_pass, nullptr),
+    strProperty(CONN_AP_IP, PROP_SAVE, conn_set_ap_ip, conn_get_ap_ip),
+    strProperty(CONN_AP_SUBNET, PROP_SAVE, conn_set_ap_subnet, conn_get_ap_subnet),
+    intProperty(CONN_AP_CHANNEL, 1, 13, PROP_SAVE, conn_set_ap_channel, conn_get_ap_channel),
+    boolProperty(CONN_AP_DHCP, PROP_SAVE, conn_set_ap_dhcp, conn_get_ap_dhcp),
+    strProperty(CONN_MDNS_NAME, PROP_SAVE, conn_set_mdns_name, conn_get_mdns_name),
+    intProperty(CONN_HTTP_PORT, 1, 65535, PROP_SAVE, conn_set_http_port, conn_get_http_port),
+    strProperty(CONN_USER, PROP_SAVE, conn_set_user, conn_get_user),
+    strProperty(CONN_PWD, 0, conn_set_pwd, nullptr),
+    strProperty(CONN_NTP_SERVER, PROP_SAVE, conn_set_ntp_server, conn_get_ntp_server),
+    intProperty(CONN_GMT_OFFSET, -43200, 50400, PROP_SAVE, conn_set_gmt_offset, conn_get_gmt_offset),
+    intProperty(CONN_DST_OFFSET, -7200, 7200, PROP_SAVE, conn_set_dst_offset, conn_get_dst_offset),
+    boolProperty(CONN_OTA_ENABLED, PROP_SAVE, conn_set_ota_enabled, conn_get_ota_enabled),
+    strProperty(CONN_OTA_PASSWORD, 0, conn_set_ota_password, nullptr)
+};
+
+CLAppConn::CLAppConn() : properties(conn_properties) {
     setTag("conn");
 }
 
@@ -266,11 +357,13 @@ int CLAppConn::loadFromJson(JsonObject jctx, bool full_set) {
     return OK;
 }
 
-void CLAppConn::setStaticIP (IPAddress ** ip_address, const char * strval) {
+int CLAppConn::setStaticIP (IPAddress ** ip_address, const char * strval) {
     if(!*ip_address) *ip_address = new IPAddress();
     if(!(*ip_address)->fromString(strval)) {
             ESP_LOGW(tag,"%s is invalid IP address", strval);
+            return FAIL;
     }
+    return OK;
 }
 
 void CLAppConn::readIPFromJSON (JsonObject context, IPAddress ** ip_address, const __FlashStringHelper* token) {
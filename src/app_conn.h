@@ -89,6 +89,8 @@ class CLAppConn : public CLAppComponent {
         int loadFromJson(JsonObject jctx, bool full_set = true);
         int saveToJson(JsonObject jctx, bool full_set = true);
 
+        CLPropertyRegistry * getProperties() {return &properties;};
+
         int start();
         bool stop() {return WiFi.disconnect();};
 
@@ -118,7 +120,7 @@ class CLAppConn : public CLAppComponent {
         bool isDHCPEnabled() {return dhcp;};
         void setDHCPEnabled(bool val) {dhcp = val;};
         StaticIP * getStaticIP() {return &staticIP;};
-        void setStaticIP(IPAddress ** address, const char * strval);
+        int setStaticIP(IPAddress ** address, const char * strval);
 
         wl_status_t wifiStatus() {return (accesspoint?ap_status:WiFi.status());};
 
@@ -222,6 +224,9 @@ class CLAppConn : public CLAppComponent {
         char localTimeString[50];
         char upTimeString[50];
 
+        // settings which can be changed at runtime
+        CLPropertyRegistry properties;
+
 };
 
 extern CLAppConn AppConn;
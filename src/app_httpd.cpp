@@ -1,5 +1,11 @@
 #include "app_httpd.h"
 
+#ifdef ENABLE_EMBEDDED_ASSETS
+#include "embedded_assets.h"   // generated by scripts/gzip_assets.py
+#endif
+
+#include <algorithm>
+
 CLAppHttpd::CLAppHttpd() {
     // Gather static values used when dumping status; these are slow functions, so just do them once during startup
     _sketchSize = ESP.getSketchSize();;
@@ -11,23 +17,113 @@ CLAppHttpd::CLAppHttpd() {
 #endif
 }
 
-int IRAM_ATTR bcastBufImgCallback(uint8_t* buffer, size_t size) {
-    return AppHttpd.bcastBufImg(buffer, size);
+void IRAM_ATTR onFrameReady(void * param, uint32_t seq){
+    // single frames are captured for the still requests only
+    if(AppHttpd.getStreamCount() > 0) {
+        AppHttpd.bcastFrame();
+        AppHttpd.wakeMjpegStreams();
+    }
+    AppHttpd.serveStills(seq == 0);
+}
+
+void onStillTimeout(TimerHandle_t timer) {
+    AppHttpd.serveStills(false);
 }
 
-void IRAM_ATTR onSnapTimer(TimerHandle_t pxTimer){
-    AppCam.snapFrame(bcastBufImgCallback);
+int IRAM_ATTR CLAppHttpd::bcastFrame() {
+    CamFrameHandle frame = AppCam.getFrame();
+    if(!frame) return FAIL;
+
+    // the capture task runs independently, so send only the frames not sent yet
+    if(frame->seq == _last_frame_seq) return OK;
+    _last_frame_seq = frame->seq;
+
+    int64_t timestamp = frame->timestamp;
+    Latency.record(LATENCY_CALLBACK, esp_timer_get_time() - timestamp);
+
+    // all clients are queued with the same buffer; the frame slot is returned to the ring 
+    // when the last client has finished sending it
+    CamFrameBuffer buffer = CLFrameRing::getBuffer(frame);
+
+    int res = FAIL;
+    for(int i=0; i < _max_streams; i++) {
+        StreamClient * sc = &stream_clients[i];
+        // HTTP MJPEG clients pull the frames from the ring themselves
+        if(!sc->id || (sc->id & MJPEG_CLIENT_FLAG)) continue;
+
+        AsyncWebSocketClient * client = ws->client(sc->id);
+        if(!client || client->status() != WS_CONNECTED) continue;
+
+        if(!isFrameDue(sc, frame->timestamp)) continue;
+
+        // the client is lagging; skip the frame for it, it will get the newest one when drained
+        if(client->queueLen() >= _stream_queue) {
+            frameDropped(sc);
+            continue;
+        }
+
+        if(client->binary(buffer)) {
+            // the send latency is recorded by the ring when the last client has released the frame
+            frame->sent = true;
+            Latency.record(LATENCY_ENQUEUE, esp_timer_get_time() - timestamp);
+            frameSent(sc, buffer->size());
+            res = OK;
+        }
+        else {
+            frameDropped(sc);
+        }
+    }
+
+    if(esp_timer_get_time() - _sample_start >= STREAM_SAMPLE_INTERVAL) sampleStreams();
+
+    return res;
 }
 
-int IRAM_ATTR CLAppHttpd::bcastBufImg(uint8_t* buffer, size_t size) {
-    return ws->binaryAll(buffer, size) != 
-           AsyncWebSocket::SendStatus::DISCARDED?OK:FAIL;;
+void CLAppHttpd::sampleStreams() {
+    int64_t now = esp_timer_get_time();
+    uint32_t interval_ms = (now - _sample_start) / 1000;
+    _sample_start = now;
+
+    // the stream settings have to suit the slowest client, relative to the rate it has requested
+    StreamClient * slowest = nullptr;
+    uint32_t sent = 0, bytes = 0, dropped = 0;
+    int rate = 1;
+
+    // the counters are updated by the MJPEG streams in the network task as well
+    portENTER_CRITICAL(&_counters_lock);
+    for(int i=0; i < _max_streams; i++) {
+        StreamClient * sc = &stream_clients[i];
+        if(!sc->id || sc->sample_partial) continue;
+        if(!slowest || sc->sample_sent * getClientRate(slowest) < slowest->sample_sent * getClientRate(sc)) slowest = sc;
+    }
+    if(slowest) {
+        rate = getClientRate(slowest);
+        sent = slowest->sample_sent;
+        bytes = slowest->sample_bytes;
+        dropped = slowest->sample_dropped;
+    }
+
+    for(int i=0; i < _max_streams; i++) {
+        stream_clients[i].sample_partial = false;
+        stream_clients[i].sample_sent = 0;
+        stream_clients[i].sample_dropped = 0;
+        stream_clients[i].sample_bytes = 0;
+    }
+    portEXIT_CRITICAL(&_counters_lock);
+
+    if(slowest && AppCam.isAdaptive()) {
+        // scale the counters of a decimated client up to the stream rate
+        int stream_rate = getStreamRate();
+        AppCam.adaptStream(sent * stream_rate / rate, bytes / rate * stream_rate, dropped * stream_rate / rate, interval_ms);
+    }
 }
 
 int CLAppHttpd::start() {
     
     loadPrefs();
 
+    _boot_id = esp_random();
+
     server = new AsyncWebServer(AppConn.getHTTPPort());
     ws = new AsyncWebSocket("/ws");
     
@@ -35,27 +131,27 @@ int CLAppHttpd::start() {
         if(!request->authenticate(AppConn.getUser(), AppConn.getPwd()))
             return request->requestAuthentication();
         if(AppConn.isConfigured())
-            request->send(Storage.getFS(), "/www/camera.html", "", false, processor);
+            AppHttpd.sendPage(request, "/www/camera.html");
         else
-            request->send(Storage.getFS(), "/www/setup.html", "", false, processor);
+            AppHttpd.sendPage(request, "/www/setup.html");
     });
 
     server->on("/camera", HTTP_GET, [](AsyncWebServerRequest *request){
         if(!request->authenticate(AppConn.getUser(), AppConn.getPwd()))
             return request->requestAuthentication();
-        request->send(Storage.getFS(), "/www/camera.html", "", false, processor);
+        AppHttpd.sendPage(request, "/www/camera.html");
     });  
 
     server->on("/setup", HTTP_GET, [](AsyncWebServerRequest *request){
         if(!request->authenticate(AppConn.getUser(), AppConn.getPwd()))
             return request->requestAuthentication();
-        request->send(Storage.getFS(), "/www/setup.html", "", false, processor);
+        AppHttpd.sendPage(request, "/www/setup.html");
     });    
 
     server->on("/dump", HTTP_GET, [](AsyncWebServerRequest *request){
         if(!request->authenticate(AppConn.getUser(), AppConn.getPwd()))
             return request->requestAuthentication();
-        request->send(Storage.getFS(), "/www/dump.html", "", false, processor);
+        AppHttpd.sendPage(request, "/www/dump.html");
     });    
 
     server->on("/view", HTTP_GET, [](AsyncWebServerRequest *request){
@@ -64,32 +160,67 @@ int CLAppHttpd::start() {
         if(request->arg("mode") == "stream" || 
             request->arg("mode") == "still") {
             if(!AppCam.getLastErr()) {
-                request->send(Storage.getFS(), "/www/view.html", "", false, processor);
+                AppHttpd.sendPage(request, "/www/view.html");
             }
             else {
-                request->send(Storage.getFS(), "/www/error.html", "", false, processor);
+                AppHttpd.sendPage(request, "/www/error.html");
             }
         }
         else
             request->send(400);
     });
 
-    // adding fixed mappigs
+#ifdef ENABLE_EMBEDDED_ASSETS
+    // without the config on the file system, the folders of the default config are served from the firmware
+    if(!_mappingCount) {
+        for(const UriMapping & mapping : embedded_mappings) {
+            UriMapping *um = (UriMapping*) malloc(sizeof(UriMapping));
+            if(!um) break;
+            memcpy(um, &mapping, sizeof(UriMapping));
+            mappingList[_mappingCount++] = um;
+        }
+    }
+#endif
+
+    // adding fixed mappigs; the handler matches the files under the URI as well
+    if(loadAssets() != OK)
+        ESP_LOGI(tag, "No asset manifest, the static files are served uncompressed");
+
     for(int i=0; i<_mappingCount; i++) {
-        server->serveStatic(mappingList[i]->uri, Storage.getFS(), mappingList[i]->path).setAuthentication(AppConn.getUser(), AppConn.getPwd());
+        server->on(mappingList[i]->uri, HTTP_GET, onStaticFile).setAuthentication(AppConn.getUser(), AppConn.getPwd());
     }
 
     server->on("/control", HTTP_GET, onControl).setAuthentication(AppConn.getUser(), AppConn.getPwd());
+    // a set of settings in one request, as a JSON object
+    AsyncCallbackJsonWebHandler * batch = new AsyncCallbackJsonWebHandler("/control", onControlBatch);
+    batch->setMethod(HTTP_POST);
+    batch->setAuthentication(AppConn.getUser(), AppConn.getPwd());
+    server->addHandler(batch);
+    server->on("/stream", HTTP_GET, onStream).setAuthentication(AppConn.getUser(), AppConn.getPwd());
+    server->on("/capture", HTTP_GET, onCapture).setAuthentication(AppConn.getUser(), AppConn.getPwd());
+    server->on("/latency", HTTP_GET, onLatency).setAuthentication(AppConn.getUser(), AppConn.getPwd());
+    server->on("/metrics", HTTP_GET, onMetrics).setAuthentication(AppConn.getUser(), AppConn.getPwd());
     server->on("/status", HTTP_GET, onStatus).setAuthentication(AppConn.getUser(), AppConn.getPwd());
     server->on("/system", HTTP_GET, onSystemStatus).setAuthentication(AppConn.getUser(), AppConn.getPwd());
     server->on("/info", HTTP_GET, onInfo).setAuthentication(AppConn.getUser(), AppConn.getPwd());
 
     
-    // adding WebSocket handler
+    // adding WebSocket handler; the settings can be changed through it, so it requires the credentials as well
     ws->onEvent(onWsEvent);
+    ws->setAuthentication(AppConn.getUser(), AppConn.getPwd());
     server->addHandler(ws);  
 
-    _stream_timer = xTimerCreate("SnapTimer", 1000/AppCam.getFrameRate()/portTICK_PERIOD_MS, pdTRUE, 0, onSnapTimer);
+    // the frames are sent to the stream clients as soon as the capture task has published them
+    _response_lock = xSemaphoreCreateRecursiveMutex();
+    _still_timer = xTimerCreate("stills", pdMS_TO_TICKS(STILL_REQUEST_TIMEOUT) + 1, pdFALSE, NULL, onStillTimeout);
+    AppCam.setFrameHandler(onFrameReady);
+
+    if(_status_interval > 0 && 
+       xTaskCreate(statusTask, "StatusTask", HTTPD_STATUS_TASK_STACK, NULL, 
+                   HTTPD_STATUS_TASK_PRIORITY, &_status_task) != pdPASS) {
+        ESP_LOGE(tag, "Failed to start the status task, status pushes disabled");
+        _status_task = NULL;
+    }
 
     DefaultHeaders::Instance().addHeader("Access-Control-Allow-Origin", "*");
     server->begin();
@@ -111,6 +242,7 @@ void onWsEvent(AsyncWebSocket * server, AsyncWebSocketClient * client, AwsEventT
     else if(type == WS_EVT_DISCONNECT){
         ESP_LOGI(AppHttpd.getTag(),"ws[%s][%u] disconnect", server->url(), client->id());
         AppHttpd.stopStream(client->id());        
+        AppHttpd.unsubscribeStatus(client->id());
         if(AppHttpd.getControlClient() == client->id()) {
             AppHttpd.setControlClient(0);
             AppPwm.reset(RESET_ALL_PWM);
@@ -128,8 +260,8 @@ void onWsEvent(AsyncWebSocket * server, AsyncWebSocketClient * client, AwsEventT
         uint8_t* msg = (uint8_t*) data;
 
         switch(*msg) {
-            case (uint8_t)'s':
-                if(AppHttpd.startStream(client->id(), CAPTURE_STREAM) != STREAM_SUCCESS)
+            case (uint8_t)'s':  // start stream, optionally at the frame rate passed in the 2nd byte
+                if(AppHttpd.startStream(client->id(), CAPTURE_STREAM, (len > 1?*(msg+1):0)) != STREAM_SUCCESS)
                     client->close();
                 break;
             case (uint8_t)'p':  
@@ -166,6 +298,17 @@ void onWsEvent(AsyncWebSocket * server, AsyncWebSocketClient * client, AwsEventT
             case (uint8_t)'t':  // terminate stream
                 AppHttpd.stopStream(client->id());
                 break;
+            case (uint8_t)WS_SET_PROPERTY:
+                // the messages are short, fragmented ones are not supported
+                if(info->final && info->index == 0 && info->len == len)
+                    AppHttpd.onWsSetProperty(client, msg, len);
+                break;
+            case (uint8_t)WS_STATUS_SUBSCRIBE:
+                if(len > 1 && *(msg+1) == 0)
+                    AppHttpd.unsubscribeStatus(client->id());
+                else if(AppHttpd.subscribeStatus(client->id()) != OK)
+                    ESP_LOGW(AppHttpd.getTag(), "ws[%u] status subscription rejected", client->id());
+                break;
             default:
             #if (CONFIG_LOG_DEFAULT_LEVEL >= CORE_DEBUG_LEVEL )
                 Serial.printf("ws[%s] client[%u] frame[%u] %u %s[%llu - %llu]: ", server->url(), client->id(), info->num,
@@ -186,60 +329,397 @@ void onWsEvent(AsyncWebSocket * server, AsyncWebSocketClient * client, AwsEventT
 }    
 
 
-String processor(const String& var) {
-  if(var == "CAMNAME")
-    return String(AppHttpd.getName());
-  else if(var == "ERRORTEXT")
-    return AppCam.getErr();
-  else if(var == "APPURL")
-    return String(AppConn.getHTTPUrl());
-//   else if(var == "STREAMURL")
-//     return String(AppConn.getStreamUrl());
-  else
-    return String();
+/**
+ * @brief State of an HTTP MJPEG stream
+ * 
+ */
+struct MjpegStream {
+    uint32_t id;                                // stream client id
+    AsyncWebServerRequest * request;
+    AsyncWebServerResponse * response;
+    volatile bool parked;                       // the filler had no frame to send
+    CamFrameHandle frame;                       // frame currently being sent
+    uint32_t last_seq;                          // sequence number of the last frame sent
+    size_t offset;                              // bytes of the current part already sent
+    size_t header_len;
+    char header[MJPEG_PART_HEADER_SIZE];        // multipart header of the current part
+};
+
+/**
+ * @brief Response resumed by the frame fan-out besides the TCP acks and polls of the network task, 
+ * so the calls into the response are serialized.
+ * 
+ */
+template<class R> class LockedResponse : public R {
+    public:
+        using R::R;
+
+        size_t _ack(AsyncWebServerRequest *request, size_t len, uint32_t time) override {
+            AppHttpd.lockResponses();
+            size_t res = R::_ack(request, len, time);
+            // nothing of the response is touched after the call, the request may be gone
+            AppHttpd.unlockResponses();
+            return res;
+        };
+};
+
+// chunked response of an HTTP MJPEG stream
+using MjpegResponse = LockedResponse<AsyncChunkedResponse>;
+// response of a still image, possibly sent from the frame fan-out
+using StillResponse = LockedResponse<AsyncCallbackResponse>;
+
+const char MJPEG_PART_TRAILER[] = "\r\n";
+
+size_t IRAM_ATTR fillMjpegStream(MjpegStream * stream, uint8_t *buffer, size_t maxLen) {
+
+    if(!stream->frame) {
+        // the filler runs in the network task, so it never waits for a frame; a parked stream 
+        // is resumed by wakeMjpegStreams() when the next frame is published
+        CamFrameHandle frame = AppCam.getFrame();
+        if(!frame || frame->seq == stream->last_seq) {
+            stream->parked = true;
+            return RESPONSE_TRY_AGAIN;
+        }
+        stream->last_seq = frame->seq;
+
+        // frames between the deadlines of a client requesting a lower rate are skipped
+        StreamClient * sc = AppHttpd.getStreamClient(stream->id);
+        if(sc && !AppHttpd.isFrameDue(sc, frame->timestamp)) {
+            stream->parked = true;
+            return RESPONSE_TRY_AGAIN;
+        }
+
+        Latency.record(LATENCY_CALLBACK, esp_timer_get_time() - frame->timestamp);
+
+        stream->frame = frame;
+        stream->offset = 0;
+        stream->header_len = snprintf(stream->header, sizeof(stream->header),
+                                      "--" MJPEG_BOUNDARY "\r\nContent-Type: image/jpeg\r\nContent-Length: %u\r\n"
+                                      "X-Timestamp: %lld.%06lld\r\n\r\n",
+                                      frame->data.size(), frame->timestamp / 1000000, frame->timestamp % 1000000);
+    }
+    stream->parked = false;
+
+    const std::vector<uint8_t> &data = stream->frame->data;
+    size_t part_len = stream->header_len + data.size() + sizeof(MJPEG_PART_TRAILER) - 1;
+    size_t len = 0;
+
+    // the part is copied straight from the frame buffer into the TCP buffer
+    while(len < maxLen && stream->offset < part_len) {
+        const uint8_t * src;
+        size_t avail;
+        if(stream->offset < stream->header_len) {
+            src = (const uint8_t*) stream->header + stream->offset;
+            avail = stream->header_len - stream->offset;
+        }
+        else if(stream->offset < stream->header_len + data.size()) {
+            src = data.data() + (stream->offset - stream->header_len);
+            avail = stream->header_len + data.size() - stream->offset;
+        }
+        else {
+            src = (const uint8_t*) MJPEG_PART_TRAILER + (stream->offset - stream->header_len - data.size());
+            avail = part_len - stream->offset;
+        }
+        size_t n = min(avail, maxLen - len);
+        memcpy(buffer + len, src, n);
+        len += n;
+        stream->offset += n;
+    }
+
+    if(stream->offset >= part_len) {
+        StreamClient * sc = AppHttpd.getStreamClient(stream->id);
+        if(sc) AppHttpd.frameSent(sc, part_len);
+        Latency.record(LATENCY_ENQUEUE, esp_timer_get_time() - stream->frame->timestamp);
+        // return the frame to the ring as soon as it is sent
+        stream->frame.reset();
+    }
+
+    return len;
+}
+
+void onStream(AsyncWebServerRequest *request) {
+    if (AppCam.getLastErr()) {
+        request->send(500);
+        return;
+    }
+
+    uint32_t id = AppHttpd.nextMjpegClientId();
+    int fps = (request->hasArg(FPSTR(HTTPD_FPS_ARG))?request->arg(FPSTR(HTTPD_FPS_ARG)).toInt():0);
+
+    // same admission as for the WebSocket streams
+    StreamResponseEnum res = AppHttpd.startStream(id, CAPTURE_STREAM, fps);
+    if(res != STREAM_SUCCESS) {
+        AppHttpd.removeStreamClient(id);
+        request->send(res == STREAM_NUM_EXCEEDED?503:500);
+        return;
+    }
+
+    std::shared_ptr<MjpegStream> stream = std::make_shared<MjpegStream>();
+    stream->id = id;
+    stream->request = request;
+    stream->parked = false;
+    stream->last_seq = 0;
+    stream->offset = 0;
+    stream->header_len = 0;
+
+    AsyncWebServerResponse *response = new MjpegResponse("multipart/x-mixed-replace;boundary=" MJPEG_BOUNDARY,
+        [stream](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+            return fillMjpegStream(stream.get(), buffer, maxLen);
+        });
+    stream->response = response;
+    response->addHeader("Cache-Control", "no-cache, no-store");
+
+    // the stream is owned by the response; it is unregistered before the request and the response are deleted
+    MjpegStream * registered = stream.get();
+    request->onDisconnect([id, registered]() {
+        AppHttpd.unregisterMjpegStream(registered);
+        AppHttpd.stopStream(id);
+    });
+    request->send(response);
+    AppHttpd.registerMjpegStream(registered);
+}
+
+int CLAppHttpd::registerMjpegStream(MjpegStream * stream) {
+    int res = FAIL;
+    lockResponses();
+    for(int i=0; i < MAX_VIDEO_STREAMS; i++) {
+        if(!_mjpeg_streams[i]) {
+            _mjpeg_streams[i] = stream;
+            res = OK;
+            break;
+        }
+    }
+    unlockResponses();
+    // without the wake-up the stream still resumes on the polls of the connection
+    if(res != OK) ESP_LOGW(tag, "No room to register the MJPEG stream %08x", stream->id);
+    return res;
+}
+
+void CLAppHttpd::unregisterMjpegStream(MjpegStream * stream) {
+    // waits for a wake-up of the stream in progress
+    lockResponses();
+    for(int i=0; i < MAX_VIDEO_STREAMS; i++) 
+        if(_mjpeg_streams[i] == stream) _mjpeg_streams[i] = nullptr;
+    unlockResponses();
+}
+
+void CLAppHttpd::wakeMjpegStreams() {
+    lockResponses();
+    for(int i=0; i < MAX_VIDEO_STREAMS; i++) {
+        MjpegStream * stream = _mjpeg_streams[i];
+        if(!stream || !stream->parked) continue;
+
+        // resumed the same way as by a poll of the connection; with data in flight, the ack resumes it
+        AsyncWebServerRequest * request = stream->request;
+        if(!request->client() || !request->client()->canSend()) continue;
+
+        stream->parked = false;
+        stream->response->_ack(request, 0, 0);
+    }
+    unlockResponses();
+}
+
+void sendStill(AsyncWebServerRequest *request, CamFrameHandle frame) {
+    char etag[24];
+    AppHttpd.getETag(etag, sizeof(etag), frame->seq);
+
+    if(request->hasHeader("If-None-Match") && request->header("If-None-Match") == etag) {
+        AsyncWebServerResponse *response = request->beginResponse(304);
+        response->addHeader("ETag", etag);
+        request->send(response);
+        return;
+    }
+
+    // the image is copied straight from the frame buffer into the TCP buffer
+    AsyncWebServerResponse *response = new StillResponse("image/jpeg", frame->data.size(),
+        [frame](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+            size_t len = min(maxLen, frame->data.size() - index);
+            memcpy(buffer, frame->data.data() + index, len);
+            return len;
+        });
+
+    response->addHeader("ETag", etag);
+    response->addHeader("Cache-Control", "no-cache");
+
+    if(AppConn.isNTPSyncDone()) {
+        char last_modified[32];
+        struct tm tm_time;
+        time_t captured = time(nullptr) - (esp_timer_get_time() - frame->timestamp) / 1000000;
+        gmtime_r(&captured, &tm_time);
+        strftime(last_modified, sizeof(last_modified), "%a, %d %b %Y %H:%M:%S GMT", &tm_time);
+        response->addHeader("Last-Modified", last_modified);
+    }
+
+    request->send(response);
+    AppCam.imageServed();
+}
+
+void onCapture(AsyncWebServerRequest *request) {
+    if (AppCam.getLastErr()) {
+        request->send(500);
+        return;
+    }
+
+    uint32_t max_age = AppHttpd.getStillMaxAge();
+    if(request->hasArg(FPSTR(HTTPD_MAXAGE_ARG)))
+        max_age = request->arg(FPSTR(HTTPD_MAXAGE_ARG)).toInt();
+
+    // pollers within max_age share the same frame instead of triggering a capture each
+    CamFrameHandle frame = AppCam.getFreshFrame(max_age);
+    if(frame) {
+        sendStill(request, frame);
+        return;
+    }
+
+    // otherwise the request is answered from the frame fan-out when the new frame is captured
+    if(AppHttpd.queueStill(request) != OK) {
+        request->send(503);
+        return;
+    }
+    AppCam.requestStill();
+}
+
+int CLAppHttpd::queueStill(AsyncWebServerRequest * request, uint32_t id) {
+    int res = FAIL;
+    lockResponses();
+    for(int i=0; i < MAX_STILL_REQUESTS; i++) {
+        StillRequest * sr = &_still_requests[i];
+        if(sr->request || sr->id) continue;
+        sr->request = request;
+        sr->id = id;
+        sr->after_seq = AppCam.getFrameSeq();
+        sr->since = esp_timer_get_time();
+        res = OK;
+        break;
+    }
+    unlockResponses();
+
+    if(res != OK) {
+        ESP_LOGW(tag, "Too many still image requests waiting");
+        return res;
+    }
+
+    // the request is forgotten before it is deleted
+    if(request) request->onDisconnect([request]() {AppHttpd.cancelStill(request);});
+
+    // the still is answered with 503 if the frame doesn't come, e.g. the fan-out of a failed capture is lost
+    if(_still_timer && !xTimerIsTimerActive(_still_timer)) 
+        xTimerStart(_still_timer, pdMS_TO_TICKS(CAM_FRAME_PEND_TIMEOUT));
+
+    return res;
+}
+
+void CLAppHttpd::cancelStill(AsyncWebServerRequest * request) {
+    // waits for the answer in progress
+    lockResponses();
+    for(int i=0; i < MAX_STILL_REQUESTS; i++) 
+        if(_still_requests[i].request == request) _still_requests[i] = {};
+    unlockResponses();
+}
+
+void CLAppHttpd::serveStills(bool failed) {
+    lockResponses();
+
+    CamFrameHandle frame = AppCam.getFrame();
+    int64_t now = esp_timer_get_time();
+    bool waiting = false;
+
+    for(int i=0; i < MAX_STILL_REQUESTS; i++) {
+        StillRequest * sr = &_still_requests[i];
+        if(!sr->request && !sr->id) continue;
+
+        bool ready = (frame && frame->seq > sr->after_seq);
+        // a failed single capture won't be followed by another frame
+        bool expired = (!ready && ((failed && !AppCam.isCapturing()) || 
+                                   now - sr->since >= STILL_REQUEST_TIMEOUT * 1000LL));
+        if(!ready && !expired) {
+            waiting = true;
+            continue;
+        }
+
+        StillRequest still = *sr;
+        *sr = {};
+
+        if(still.request) {
+            if(!still.request->client()) continue;
+            if(ready) 
+                sendStill(still.request, frame);
+            else 
+                still.request->send(503);
+        }
+        else if(ready) {
+            AsyncWebSocketClient * client = ws->client(still.id);
+            if(client && client->binary(CLFrameRing::getBuffer(frame))) AppCam.imageServed();
+        }
+    }
+
+    // runs in the timer service task, so the timer command doesn't wait
+    if(waiting && _still_timer && !xTimerIsTimerActive(_still_timer)) xTimerStart(_still_timer, 0);
+
+    unlockResponses();
+}
+
+void onLatency(AsyncWebServerRequest *request) {
+    JsonDocument jdoc;
+    JsonObject jstr = jdoc.to<JsonObject>();
+
+    Latency.saveToJson(jstr);
+
+    // the histograms are returned before they are reset, so no samples are lost between two polls
+    if(request->hasArg(FPSTR(HTTPD_RESET_ARG)) && request->arg(FPSTR(HTTPD_RESET_ARG)).toInt())
+        Latency.reset();
+
+    sendJson(request, jdoc);
 }
 
-StreamResponseEnum CLAppHttpd::startStream(uint32_t id, CaptureModeEnum streammode) {
+void onMetrics(AsyncWebServerRequest *request) {
+    // the metrics are printed straight into the response buffer, no JSON document is built
+    AsyncResponseStream *response = request->beginResponseStream("text/plain; version=0.0.4");
+    AppHttpd.printMetrics(response);
+    request->send(response);
+}
+
+StreamResponseEnum CLAppHttpd::startStream(uint32_t id, CaptureModeEnum streammode, int fps) {
     
     // if video stream requested, check if we can add extra
     if(streammode == CAPTURE_STREAM) {
         if(_streamCount+1 > _max_streams) return STREAM_NUM_EXCEEDED;
-        if(addStreamClient(id) != OK) return STREAM_CLIENT_REGISTER_FAILED;
+        if(addStreamClient(id, fps) != OK) return STREAM_CLIENT_REGISTER_FAILED;
     }
 
-    if(!_stream_timer) return STREAM_TIMER_NOT_INITIALIZED;
-
     if(streammode == CAPTURE_STREAM) {
 
+        ESP_LOGI(AppHttpd.getTag(),"Stream start, requested frame rate = %d", fps);
+
+        _streamCount++;
 
-        ESP_LOGI(AppHttpd.getTag(),"Stream start, frame period = %d", xTimerGetPeriod(_stream_timer));
+        // the capture runs at the highest rate requested
+        updateStreamRate();
         
         // if stream is not started, start 
-        if(xTimerIsTimerActive(_stream_timer) == pdFALSE) {
-            vTimerSetReloadMode(_stream_timer, pdTRUE);
-            if(xTimerStart(_stream_timer, 0) == pdPASS)
-                ESP_LOGI(AppHttpd.getTag(),"Stream timer started");
-            else
-                ESP_LOGW(AppHttpd.getTag(),"Failed to start the Stream timer!");
+        if(_streamCount == 1) {
+            AppCam.startCapture();
+            _sample_start = esp_timer_get_time();
+            ESP_LOGI(AppHttpd.getTag(),"Continuous capture started");
         }
 
-        _streamCount++;
-
     }
     else if(streammode == CAPTURE_STILL) {
         ESP_LOGI(tag,"Still image requested");
-        // if video stream is not active, take the picture as usual
-        if(xTimerIsTimerActive(_stream_timer) == pdFALSE) {
-        
-            if (AppCam.snapStillImage(bcastBufImgCallback) != OK) {
-                return STREAM_IMAGE_CAPTURE_FAILED;
-            }
-            
+        AsyncWebSocketClient * client = ws->client(id);
+        if(!client) return STREAM_CLIENT_NOT_FOUND;
+
+        // served from the latest frame if it is fresh enough (i.e. while streaming), 
+        // otherwise from the frame fan-out when the new frame is captured
+        CamFrameHandle frame = AppCam.getFreshFrame(_still_max_age);
+        if(frame) {
+            if(!client->binary(CLFrameRing::getBuffer(frame))) return STREAM_IMAGE_CAPTURE_FAILED;
+            AppCam.imageServed();
         }
         else {
-            ESP_LOGI(tag, "Image to be taken from the parallel video stream");
+            if(queueStill(nullptr, id) != OK) return STREAM_NUM_EXCEEDED;
+            AppCam.requestStill();
         }
-        
     }
     else
         return STREAM_MODE_NOT_SUPPORTED;
@@ -251,21 +731,18 @@ StreamResponseEnum CLAppHttpd::stopStream(uint32_t id) {
 
     if(removeStreamClient(id) != OK) return STREAM_CLIENT_NOT_FOUND;
 
-    if(!_stream_timer) return STREAM_TIMER_NOT_INITIALIZED;
-    
-    // if the stream is the last one active, stop the timer
-    if(xTimerIsTimerActive(_stream_timer) != pdFALSE && _streamCount == 1) {
-        vTimerSetReloadMode(_stream_timer, pdFALSE);
-        if(xTimerStop(_stream_timer, 0) == pdPASS)
-            ESP_LOGI(tag,"Stop sent to Stream timer");
-        else
-            ESP_LOGW(tag,"Failed to post the stop command to the Stream timer!");
+    // if the stream is the last one active, stop the capture
+    if(_streamCount == 1) {
+        AppCam.stopCapture();
+        ESP_LOGI(tag,"Continuous capture stopped");
 
         if(AppCam.getLamp()>0 and AppCam.isAutoLamp()) AppCam.setLamp(0);     
     }
     
     _streamsServed++;
     _streamCount--;
+
+    if(_streamCount > 0) updateStreamRate();
     
     ESP_LOGI(tag,"Stream stopped");
     return STREAM_SUCCESS;
@@ -292,8 +769,6 @@ void onControl(AsyncWebServerRequest *request) {
 #endif
 
     int res = 0;
-    long val = value.toInt();
-    sensor_t * s = AppCam.getSensor();
 
     if(variable == "cmdout") {
     #if (CONFIG_LOG_DEFAULT_LEVEL >= CORE_DEBUG_LEVEL )
@@ -344,169 +819,736 @@ void onControl(AsyncWebServerRequest *request) {
     else if(variable == "reboot") {
         request->send(200);
         if (AppCam.getLamp() != -1) AppCam.setLamp(0); // kill the lamp; otherwise it can remain on during the soft-reboot
+        CLAppComponent::flushPrefs();   // write the preferences saved just before
         Storage.getFS().end();      // close file storage
         resetI2CBus();
         scheduleReboot(3);
+        return;
     }
-    else if(variable == FPSTR(CONN_SSID)) {AppConn.setSSID(value.c_str());AppConn.setPassword("");}
-    else if(variable == FPSTR(CONN_PASSWORD)) AppConn.setPassword(value.c_str());
-    else if(variable == FPSTR(CONN_ST_IP)) AppConn.setStaticIP(&(AppConn.getStaticIP()->ip), value.c_str());
-    else if(variable == FPSTR(CONN_ST_SUBNET)) AppConn.setStaticIP(&(AppConn.getStaticIP()->netmask), value.c_str());
-    else if(variable == FPSTR(CONN_ST_GATEWAY)) AppConn.setStaticIP(&(AppConn.getStaticIP()->gateway), value.c_str());
-    else if(variable == FPSTR(CONN_DNS1)) AppConn.setStaticIP(&(AppConn.getStaticIP()->dns1), value.c_str());
-    else if(variable == FPSTR(CONN_DNS2)) AppConn.setStaticIP(&(AppConn.getStaticIP()->dns2), value.c_str());
-    else if(variable == FPSTR(CONN_AP_IP)) AppConn.setStaticIP(&(AppConn.getAPIP()->ip), value.c_str());
-    else if(variable == FPSTR(CONN_AP_SUBNET)) AppConn.setStaticIP(&(AppConn.getAPIP()->netmask), value.c_str());
-    else if(variable == FPSTR(CONN_AP_SSID)) AppConn.setApName(value.c_str());
-    else if(variable == FPSTR(CONN_AP_PASS)) AppConn.setApPass(value.c_str());
-    else if(variable == FPSTR(CONN_MDNS_NAME)) AppConn.setMDNSName(value.c_str());
-    else if(variable == FPSTR(CONN_NTP_SERVER)) AppConn.setNTPServer(value.c_str());
-    else if(variable == FPSTR(CONN_USER)) AppConn.setUser(value.c_str());
-    else if(variable == FPSTR(CONN_PWD)) AppConn.setPwd(value.c_str());
-    else if(variable == FPSTR(CONN_OTA_PASSWORD)) AppConn.setOTAPassword(value.c_str());
-    else if(variable == FPSTR(CAM_FRAMESIZE)) {
-        if(s->pixformat == PIXFORMAT_JPEG) res = s->set_framesize(s, (framesize_t)val);
-    }
-    else if(variable == FPSTR(CAM_QUALITY)) res = s->set_quality(s, val);
-    else if(variable == FPSTR(CAM_XCLK)) { AppCam.setXclk(val); res = s->set_xclk(s, LEDC_TIMER_0, AppCam.getXclk()); }
-    else if(variable == FPSTR(CAM_CONTRAST)) res = s->set_contrast(s, val);
-    else if(variable == FPSTR(CAM_BRIGHTNESS)) res = s->set_brightness(s, val);
-    else if(variable == FPSTR(CAM_SATURATION)) res = s->set_saturation(s, val);
-    else if(variable == FPSTR(CAM_SHARPNESS)) res = s->set_sharpness(s, val);
-    else if(variable == FPSTR(CAM_DENOISE)) res = s->set_denoise(s, val);
-    else if(variable == FPSTR(CAM_GAINCEILING)) res = s->set_gainceiling(s, (gainceiling_t)val);
-    else if(variable == FPSTR(CAM_COLORBAR)) res = s->set_colorbar(s, val);
-    else if(variable == FPSTR(CAM_AWB)) res = s->set_whitebal(s, val);
-    else if(variable == FPSTR(CAM_AGC)) res = s->set_gain_ctrl(s, val);
-    else if(variable == FPSTR(CAM_AEC)) res = s->set_exposure_ctrl(s, val);
-    else if(variable == FPSTR(CAM_HMIRROR)) res = s->set_hmirror(s, val);
-    else if(variable == FPSTR(CAM_VFLIP)) res = s->set_vflip(s, val);
-    else if(variable == FPSTR(CAM_AWB_GAIN)) res = s->set_awb_gain(s, val);
-    else if(variable == FPSTR(CAM_AGC_GAIN)) res = s->set_agc_gain(s, val);
-    else if(variable == FPSTR(CAM_AEC_VALUE)) res = s->set_aec_value(s, val);
-    else if(variable == FPSTR(CAM_AEC2)) res = s->set_aec2(s, val);
-    else if(variable == FPSTR(CAM_DCW)) res = s->set_dcw(s, val);
-    else if(variable == FPSTR(CAM_BPC)) res = s->set_bpc(s, val);
-    else if(variable == FPSTR(CAM_WPC)) res = s->set_wpc(s, val);
-    else if(variable == FPSTR(CAM_RAW_GMA)) res = s->set_raw_gma(s, val);
-    else if(variable == FPSTR(CAM_LENC)) res = s->set_lenc(s, val);
-    else if(variable == FPSTR(CAM_SPECIAL_EFFECT)) res = s->set_special_effect(s, val);
-    else if(variable == FPSTR(CAM_WB_MODE)) res = s->set_wb_mode(s, val);
-    else if(variable == FPSTR(CAM_AE_LEVEL)) res = s->set_ae_level(s, val);
-    else if(variable == FPSTR(CAM_ROTATE)) AppCam.setRotation(val);
-    else if(variable == FPSTR(CAM_FRAME_RATE)) {
-        AppCam.setFrameRate(val);
-        AppHttpd.setFrameRate(val);
-    }
-    else if(variable ==  FPSTR(CAM_AUTOLAMP) && AppCam.getLamp() != -1) {
-        AppCam.setAutoLamp(val);
-    }
-    else if(variable ==  FPSTR(CAM_LAMP) && AppCam.getLamp() != -1) {
-        AppCam.setLamp(constrain(val,0,100));
-    }
-    else if(variable ==  FPSTR(CAM_FLASHLAMP) && AppCam.getLamp() != -1) {
-        AppCam.setFlashLamp(constrain(val,0,100));
-    }
-    else if(variable == FPSTR(CONN_LOAD_AS_AP)) AppConn.setLoadAsAP(val);
-    else if(variable == FPSTR(CONN_AP_TIMEOUT)) AppConn.setAPTimeout(val);
-    else if(variable == FPSTR(CONN_AP_CHANNEL)) AppConn.setAPChannel(val);
-    else if(variable == FPSTR(CONN_AP_DHCP)) AppConn.setAPDHCP(val);
-    else if(variable == FPSTR(CONN_DHCP)) AppConn.setDHCPEnabled(val);
-    else if(variable == FPSTR(CONN_HTTP_PORT)) AppConn.setHTTPPort(val);
-    else if(variable == FPSTR(CONN_OTA_ENABLED)) AppConn.setOTAEnabled(val);
-    else if(variable == FPSTR(CONN_GMT_OFFSET)) AppConn.setGmtOffset_sec(val);
-    else if(variable == FPSTR(CONN_DST_OFFSET)) AppConn.setDaylightOffset_sec(val);
-#ifdef ENABLE_MAIL_FEATURE
-    else if(variable == FPSTR(MAIL_SMTP_SERVER)) AppMailSender.setSMTPServer(value.c_str());
-    else if(variable == FPSTR(MAIL_SMTP_PORT)) AppMailSender.setSMTPPort(val);
-    else if(variable == FPSTR(MAIL_FROM)) AppMailSender.setFrom(value.c_str());
-    else if(variable == FPSTR(MAIL_TO)) AppMailSender.setTo(value.c_str());
-    else if(variable == FPSTR(MAIL_SNAPONSTART)) AppMailSender.setSnapOnStart(val);
-    else if(variable == FPSTR(MAIL_SLEEPONCOMPLETE)) AppMailSender.setSleepOnComplete(val);
-    else if(variable == FPSTR(MAIL_USERNAME)) AppMailSender.setUser(value.c_str());
-    else if(variable == FPSTR(MAIL_PASSWORD)) AppMailSender.setPwd(value.c_str());
-    else if(variable == FPSTR(MAIL_PERIOD)) AppMailSender.setPeriod(val);
-    else if(variable == FPSTR(MAIL_NUM_PERIODS)) AppMailSender.setNumPeriods(val);
-    else if(variable == FPSTR(MAIL_START_AT)) AppMailSender.setStartAt(value);
-    else if(variable == FPSTR(MAIL_FINISH_AT)) AppMailSender.setFinishAt(value);
-#endif
-    else {
-        res = -1;
-    }
-    if(res){
+
+    CLPropertyRegistry * props;
+    const PropertyDef * prop = AppHttpd.findProperty(variable.c_str(), &props);
+    if(!prop || props->set(prop, value.c_str()) != OK) {
         request->send(400);
         return;
     }
+    CLAppComponent::bumpGeneration();
     request->send(200);
+    AppHttpd.notifyProperty(prop);
+}
+
+void onControlBatch(AsyncWebServerRequest *request, JsonVariant &json) {
+
+    if (AppCam.getLastErr()) {
+        request->send(500);
+        return;
+    }
+
+    JsonObject jctx = json.as<JsonObject>();
+    if(jctx.isNull() || jctx.size() == 0 || jctx.size() > PROPERTY_BATCH_SIZE) {
+        request->send(400);
+        return;
+    }
+
+    JsonDocument jdoc;
+    int failed = AppHttpd.setProperties(jctx, jdoc.to<JsonObject>());
+
+    sendJson(request, jdoc, (failed?400:200));
+}
+
+int CLAppHttpd::setProperties(JsonObject jctx, JsonObject results) {
+    struct BatchEntry {
+        CLPropertyRegistry * registry; 
+        int rank;
+        const PropertyDef * prop; 
+        JsonVariantConst val;
+    };
+    BatchEntry batch[PROPERTY_BATCH_SIZE];
+    size_t count = 0;
+    int failed = 0;
+
+    // validate all settings before applying any of them
+    for(JsonPair kv : jctx) {
+        if(count == PROPERTY_BATCH_SIZE) break;
+
+        BatchEntry &entry = batch[count];
+        entry.prop = findProperty(kv.key().c_str(), &entry.registry, &entry.rank);
+        entry.val = kv.value();
+        if(!entry.prop) {
+            results[kv.key()] = FPSTR(PROP_RESULT_UNKNOWN);
+            failed++;
+        }
+        else if(entry.registry->validate(entry.prop, entry.val) != OK) {
+            results[kv.key()] = FPSTR(PROP_RESULT_INVALID);
+            failed++;
+        }
+        else count++;
+    }
+
+    if(failed) {
+        for(size_t i=0; i < count; i++) results[batch[i].prop->key] = FPSTR(PROP_RESULT_SKIPPED);
+        return failed;
+    }
+
+    // the components in the order of findProperty(), then the order of the property table,
+    // which is the order the sensor takes the settings in
+    std::sort(batch, batch + count, [](const BatchEntry &a, const BatchEntry &b) {
+        if(a.rank != b.rank) return a.rank < b.rank;
+        return a.prop < b.prop;
+    });
+
+    int applied = 0;
+    for(size_t i=0; i < count; i++) {
+        BatchEntry &entry = batch[i];
+        int res = OK;
+        // unchanged settings cost no sensor write
+        if(!entry.registry->isCurrent(entry.prop, entry.val)) {
+            res = entry.registry->setJson(entry.prop, entry.val);
+            if(res == OK) {
+                applied++;
+                notifyProperty(entry.prop);
+            }
+        }
+        results[entry.prop->key] = FPSTR(res == OK?PROP_RESULT_OK:PROP_RESULT_FAILED);
+        if(res != OK) failed++;
+    }
+
+    if(applied) CLAppComponent::bumpGeneration();
+
+    return failed;
+}
+
+void CLAppHttpd::onWsSetProperty(AsyncWebSocketClient * client, const uint8_t * msg, size_t len) {
+    char key[PROPERTY_KEY_SIZE];
+    uint8_t klen = (len > 1?msg[1]:0);
+    if(len < 3 + klen || klen == 0 || klen >= sizeof(key)) return;
+
+    memcpy(key, msg + 2, klen);
+    key[klen] = '\0';
+    uint8_t type = msg[2 + klen];
+    const uint8_t * value = msg + 3 + klen;
+    size_t vlen = len - 3 - klen;
+
+    CLPropertyRegistry * props;
+    const PropertyDef * prop = findProperty(key, &props);
+
+    int res = FAIL;
+    if(prop && type == WS_VALUE_INT && vlen == 4) {
+        // the bytes are widened unsigned, a byte shifted into the sign bit of an int is undefined
+        res = props->setInt(prop, (int32_t)((uint32_t)value[0] | (uint32_t)value[1] << 8 | 
+                                            (uint32_t)value[2] << 16 | (uint32_t)value[3] << 24));
+    }
+    else if(prop && type == WS_VALUE_STRING) {
+        char * str = (char*) malloc(vlen + 1);
+        if(str) {
+            memcpy(str, value, vlen);
+            str[vlen] = '\0';
+            res = props->set(prop, str);
+            free(str);
+        }
+    }
+
+    if(res != OK) {
+        uint8_t err[3 + PROPERTY_KEY_SIZE] = {WS_PROPERTY_ERROR, (uint8_t)(prop?WS_ERROR_REJECTED:WS_ERROR_UNKNOWN), klen};
+        memcpy(err + 3, key, klen);
+        client->binary(err, 3 + klen);
+        return;
+    }
+
+    CLAppComponent::bumpGeneration();
+    notifyProperty(prop);
+}
+
+void CLAppHttpd::notifyProperty(const PropertyDef * prop) {
+    if(!ws || !prop || !ws->count()) return;
+
+    size_t klen = strlen(prop->key);
+    const char * str = nullptr;
+    size_t vlen = 0;
+    uint8_t type = WS_VALUE_NONE;
+    if(prop->type == PROP_STRING && prop->get_str) {
+        str = prop->get_str();
+        vlen = strlen(str);
+        type = WS_VALUE_STRING;
+    }
+    else if(prop->type != PROP_STRING && prop->get) {
+        vlen = 4;
+        type = WS_VALUE_INT;
+    }
+
+    std::shared_ptr<std::vector<uint8_t>> buffer = std::make_shared<std::vector<uint8_t>>(3 + klen + vlen);
+    uint8_t * buf = buffer->data();
+    buf[0] = WS_PROPERTY_UPDATE;
+    buf[1] = klen;
+    memcpy(buf + 2, prop->key, klen);
+    buf[2 + klen] = type;
+    if(type == WS_VALUE_STRING) {
+        memcpy(buf + 3 + klen, str, vlen);
+    }
+    else if(type == WS_VALUE_INT) {
+        int32_t val = prop->get();
+        for(int i=0; i < 4; i++) buf[3 + klen + i] = (val >> (8 * i)) & 0xFF;
+    }
+
+    ws->binaryAll(buffer);
+}
+
+int CLAppHttpd::subscribeStatus(uint32_t client_id) {
+    if(!_status_task) return FAIL;
+
+    int ret = FAIL;
+    portENTER_CRITICAL(&_status_lock);
+    StatusClient * free_slot = nullptr;
+    for(int i=0; i < MAX_STATUS_CLIENTS; i++) {
+        if(_status_clients[i].id == client_id) {
+            free_slot = &_status_clients[i];
+            break;
+        }
+        if(!_status_clients[i].id && !free_slot) free_slot = &_status_clients[i];
+    }
+    if(free_slot) {
+        free_slot->id = client_id;
+        free_slot->full = true;
+        ret = OK;
+    }
+    portEXIT_CRITICAL(&_status_lock);
+
+    // the new subscriber gets the full status right away
+    if(ret == OK) xTaskNotifyGive(_status_task);
+    return ret;
+}
+
+void CLAppHttpd::unsubscribeStatus(uint32_t client_id) {
+    portENTER_CRITICAL(&_status_lock);
+    for(int i=0; i < MAX_STATUS_CLIENTS; i++)
+        if(_status_clients[i].id == client_id) _status_clients[i].id = 0;
+    portEXIT_CRITICAL(&_status_lock);
+}
+
+void statusTask(void * pvParameters) {
+    AppHttpd.statusLoop();
+}
+
+void CLAppHttpd::statusLoop() {
+    while(true) {
+        bool subscribed = false;
+        portENTER_CRITICAL(&_status_lock);
+        for(int i=0; i < MAX_STATUS_CLIENTS; i++)
+            if(_status_clients[i].id) subscribed = true;
+        portEXIT_CRITICAL(&_status_lock);
+
+        // without subscribers, the task sleeps until one comes
+        ulTaskNotifyTake(pdTRUE, (subscribed?pdMS_TO_TICKS(_status_interval):portMAX_DELAY));
+        pushStatus();
+    }
+}
+
+// serializes a JSON document into a buffer which can be shared by the WebSocket messages
+static JsonCacheBuffer serializeToBuffer(JsonDocument & jdoc) {
+    size_t len = measureJson(jdoc);
+    JsonCacheBuffer buffer = std::make_shared<std::vector<uint8_t>>(len + 1);
+    serializeJson(jdoc, (char*)buffer->data(), len + 1);
+    buffer->resize(len);
+    return buffer;
+}
+
+void CLAppHttpd::pushStatus() {
+    StatusClient clients[MAX_STATUS_CLIENTS];
+    int count = 0;
+    portENTER_CRITICAL(&_status_lock);
+    for(int i=0; i < MAX_STATUS_CLIENTS; i++) {
+        if(!_status_clients[i].id) continue;
+        clients[count++] = _status_clients[i];
+        _status_clients[i].full = false;
+    }
+    portEXIT_CRITICAL(&_status_lock);
+
+    if(!count || !ws) {
+        // the next subscriber gets the full status anyway, there is nothing to compare with
+        _status_last.clear();
+        return;
+    }
+
+    JsonDocument current;
+    dumpSystemStatusToJson(current.to<JsonObject>());
+
+    // top-level keys whose value differs from the last push; ArduinoJson compares the nested values deeply
+    JsonDocument delta;
+    JsonObject joDelta = delta.to<JsonObject>();
+    for(JsonPairConst kv : current.as<JsonObjectConst>()) {
+        if(_status_last[kv.key()] != kv.value()) joDelta[kv.key()] = kv.value();
+    }
+
+    JsonCacheBuffer full_buffer = nullptr;
+    JsonCacheBuffer delta_buffer = (joDelta.size() > 0?serializeToBuffer(delta):nullptr);
+
+    for(int i=0; i < count; i++) {
+        AsyncWebSocketClient * client = ws->client(clients[i].id);
+        if(!client || client->status() != WS_CONNECTED) continue;
+
+        if(clients[i].full) {
+            if(!full_buffer) full_buffer = serializeToBuffer(current);
+            client->text(full_buffer);
+        }
+        else if(delta_buffer) 
+            client->text(delta_buffer);
+    }
+
+    _status_last = std::move(current);
+}
+
+const PropertyDef * CLAppHttpd::findProperty(const char * key, CLPropertyRegistry ** registry, int * rank) {
+    // also the order a batch spanning several components is applied in
+    CLAppComponent * components[] = {&AppCam, &AppConn,
+#ifdef ENABLE_MAIL_FEATURE
+                                     &AppMailSender
+#endif
+                                    };
+
+    for(size_t i=0; i < sizeof(components) / sizeof(components[0]); i++) {
+        CLPropertyRegistry * props = components[i]->getProperties();
+        const PropertyDef * prop = (props?props->find(key):nullptr);
+        if(prop) {
+            if(registry) *registry = props;
+            if(rank) *rank = i;
+            return prop;
+        }
+    }
+    return nullptr;
+}
+
+void CLAppHttpd::updateStreamRate() {
+    // the requested rate is kept uncapped, so that a change of the frame rate applies without a call here
+    int rate = 0;
+    for(int i=0; i < _max_streams; i++) {
+        if(!stream_clients[i].id) continue;
+        if(!stream_clients[i].fps) {
+            rate = 0;
+            break;
+        }
+        rate = max(rate, (int)stream_clients[i].fps);
+    }
+
+    // the capture task picks the new rate up at the next frame deadline
+    AppCam.setCaptureRate(rate);
+
+    ESP_LOGI(tag, "Stream rate %d fps", getStreamRate());
+}
+
+int CLAppHttpd::getClientRate(StreamClient * sc) {
+    int frame_rate = (AppCam.getFrameRate()>0?AppCam.getFrameRate():1);
+    return (sc->fps && sc->fps < frame_rate?sc->fps:frame_rate);
+}
+
+void IRAM_ATTR CLAppHttpd::frameSent(StreamClient * sc, size_t bytes) {
+    portENTER_CRITICAL(&_counters_lock);
+    sc->sent++;
+    sc->sample_sent++;
+    sc->sample_bytes += bytes;
+    _framesSent++;
+    _bytesSent += bytes;
+    portEXIT_CRITICAL(&_counters_lock);
+}
+
+void IRAM_ATTR CLAppHttpd::frameDropped(StreamClient * sc, uint32_t count) {
+    portENTER_CRITICAL(&_counters_lock);
+    sc->dropped += count;
+    sc->sample_dropped += count;
+    _framesDropped += count;
+    portEXIT_CRITICAL(&_counters_lock);
+}
+
+bool IRAM_ATTR CLAppHttpd::isFrameDue(StreamClient * sc, int64_t timestamp) {
+    int64_t period = 1000000 / getClientRate(sc);
+
+    // half a capture period of tolerance for the jitter, so that e.g. a 5 fps client 
+    // gets exactly every 5th frame of a 25 fps stream
+    if(timestamp + 500000 / getStreamRate() < sc->next_frame) return false;
+
+    // deadlines missed by the client (stalled TCP window) or the capture count as dropped frames
+    if(sc->next_frame && timestamp - sc->next_frame >= period) {
+        frameDropped(sc, (timestamp - sc->next_frame) / period);
+    }
+
+    sc->next_frame += period;
+    // re-align on the stream instead of bursting to catch up
+    if(sc->next_frame <= timestamp) sc->next_frame = timestamp + period;
+
+    return true;
 }
 
-void CLAppHttpd::setFrameRate(int tps) {
-    if(_stream_timer)
-        xTimerChangePeriod(_stream_timer, 1000/tps/portTICK_PERIOD_MS, 100);
+void sendJson(AsyncWebServerRequest *request, JsonDocument &jdoc, int code) {
+    // the document is serialized once into a buffer of the measured size and freed by the caller, 
+    // the response holds only the payload
+    JsonCacheBuffer data = serializeToBuffer(jdoc);
+    AsyncWebServerResponse *response = request->beginResponse("application/json", data->size(),
+        [data](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+            size_t len = min(maxLen, data->size() - index);
+            memcpy(buffer, data->data() + index, len);
+            return len;
+        });
+    response->setCode(code);
+    request->send(response);
 }
 
 void onInfo(AsyncWebServerRequest *request) {
-    AsyncResponseStream *response = request->beginResponseStream("application/json");
+    AppHttpd.sendCameraStatus(request, false);
+}
+
+void onStaticFile(AsyncWebServerRequest *request) {
+    AppHttpd.sendStaticFile(request);
+}
+
+int CLAppHttpd::loadAssets() {
+    File file = Storage.open(ASSET_MANIFEST);
+    if(!file) return FAIL;
 
     JsonDocument jdoc;
-    JsonObject jstr = jdoc.to<JsonObject>();
+    DeserializationError err = deserializeJson(jdoc, file);
+    file.close();
+    if(err != DeserializationError::Ok) {
+        ESP_LOGW(tag, "Failed to parse %s: %s", ASSET_MANIFEST, err.c_str());
+        return FAIL;
+    }
+
+    JsonObject joAssets = jdoc.as<JsonObject>();
+    if(!_assets) _assets = (StaticAsset*) malloc(sizeof(StaticAsset) * MAX_STATIC_ASSETS);
+    if(!_assets) return FAIL;
+
+    _assetCount = 0;
+    for(JsonPair kv : joAssets) {
+        if(_assetCount >= MAX_STATIC_ASSETS) {
+            ESP_LOGW(tag, "Too many assets in %s, the rest are served uncompressed", ASSET_MANIFEST);
+            break;
+        }
+        StaticAsset * asset = &_assets[_assetCount];
+        if((size_t)snprintf(asset->path, sizeof(asset->path), "%s", kv.key().c_str()) >= sizeof(asset->path)) continue;
+        snprintf(asset->hash, sizeof(asset->hash), "%s", kv.value()[FPSTR(HTTPD_ASSET_HASH)] | "");
+        if(!*asset->hash) continue;
+        asset->gz = kv.value()[FPSTR(HTTPD_ASSET_GZIP)] | false;
+        asset->tmpl = kv.value()[FPSTR(HTTPD_ASSET_TEMPLATE)] | false;
+        _assetCount++;
+    }
+
+    ESP_LOGI(tag, "Loaded %d static assets", _assetCount);
+    return OK;
+}
+
+// response sending a cached file; the response keeps its own reference, so the file may be evicted meanwhile
+static AsyncWebServerResponse * beginFileResponse(AsyncWebServerRequest *request, const char * content_type, 
+                                                  CachedFile file) {
+    return request->beginResponse(content_type, file->size,
+        [file](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+            size_t len = min(maxLen, file->size - index);
+            memcpy(buffer, file->data + index, len);
+            return len;
+        });
+}
+
+// content type of a static file by its extension
+static const char * getContentType(const String & path) {
+    if(path.endsWith(".js")) return "application/javascript";
+    if(path.endsWith(".css")) return "text/css";
+    if(path.endsWith(".html") || path.endsWith(".htm")) return "text/html";
+    if(path.endsWith(".json")) return "application/json";
+    if(path.endsWith(".svg")) return "image/svg+xml";
+    if(path.endsWith(".png")) return "image/png";
+    if(path.endsWith(".jpg")) return "image/jpeg";
+    if(path.endsWith(".ico")) return "image/x-icon";
+    if(path.endsWith(".txt")) return "text/plain";
+    return "application/octet-stream";
+}
+
+void CLAppHttpd::sendStaticFile(AsyncWebServerRequest *request) {
+    const String & url = request->url();
+
+    // the handler of a mapping gets its URI and the URIs under it, e.g. /img and /img/logo.png, but not /img2
+    UriMapping * mapping = nullptr;
+    for(int i=0; i < _mappingCount && !mapping; i++) {
+        size_t len = strlen(mappingList[i]->uri);
+        if(url.startsWith(mappingList[i]->uri) && url.length() > len + 1 && url[len] == '/') 
+            mapping = mappingList[i];
+    }
+
+    if(!mapping || url.indexOf("..") >= 0) {
+        request->send(404);
+        return;
+    }
+
+    String path = String(mapping->path) + url.substring(strlen(mapping->uri));
+
+#ifdef ENABLE_EMBEDDED_ASSETS
+    // falls back to the file system if the client can't take the gzipped copy
+    const EmbeddedAsset * embedded = findEmbeddedAsset(path.c_str());
+    if(embedded && sendEmbeddedAsset(request, embedded) == OK) return;
+#endif
+
+    const StaticAsset * asset = findAsset(path.c_str());
+    if(!asset) {
+        // not in the manifest (e.g. copied to the SD card after the image was built), served as is
+        CachedFile cached = Storage.readCached(path.c_str());
+        if(cached)
+            request->send(beginFileResponse(request, getContentType(path), cached));
+        else if(Storage.exists(path)) 
+            request->send(Storage.getFS(), path, getContentType(path));
+        else
+            request->send(404);
+        return;
+    }
+
+    char cache_control[32];
+    snprintf(cache_control, sizeof(cache_control), "max-age=%u", _static_max_age);
+    sendFile(request, path, asset, cache_control);
+}
 
-    AppHttpd.dumpCameraStatusToJson(jstr, false);
+const StaticAsset * CLAppHttpd::findAsset(const char * path) {
+    for(int i=0; i < _assetCount; i++)
+        if(!strcmp(path, _assets[i].path)) return &_assets[i];
+    return nullptr;
+}
+
+static bool acceptsGzip(AsyncWebServerRequest *request) {
+    return request->hasHeader("Accept-Encoding") && request->header("Accept-Encoding").indexOf("gzip") >= 0;
+}
+
+void CLAppHttpd::sendFile(AsyncWebServerRequest *request, const String & path, const StaticAsset * asset, 
+                          const char * cache_control) {
+    bool gzip = asset->gz && acceptsGzip(request);
+
+    // the encodings are different representations, so they have their own ETags
+    char etag[STATIC_ASSET_HASH_SIZE + 8];
+    snprintf(etag, sizeof(etag), "\"%s%s\"", asset->hash, (gzip?"-gz":""));
+
+    if(sendNotModified(request, etag, cache_control)) return;
+
+    // the hot assets are served from the file cache; the files too big for it are read from the file system
+    String file_path = (gzip?path + ".gz":path);
+    CachedFile cached = Storage.readCached(file_path.c_str());
+    AsyncWebServerResponse *response;
+    if(cached)
+        response = beginFileResponse(request, getContentType(path), cached);
+    else
+        response = request->beginResponse(Storage.getFS(), file_path, getContentType(path));
+
+    if(gzip) response->addHeader("Content-Encoding", "gzip");
+
+    response->addHeader("ETag", etag);
+    response->addHeader("Cache-Control", cache_control);
+    if(asset->gz) response->addHeader("Vary", "Accept-Encoding");
+    request->send(response);
+}
+
+bool CLAppHttpd::sendNotModified(AsyncWebServerRequest *request, const char * etag, const char * cache_control) {
+    if(!request->hasHeader("If-None-Match") || request->header("If-None-Match") != etag) return false;
+
+    AsyncWebServerResponse *response = request->beginResponse(304);
+    response->addHeader("ETag", etag);
+    response->addHeader("Cache-Control", cache_control);
+    request->send(response);
+    return true;
+}
+
+void CLAppHttpd::sendPage(AsyncWebServerRequest *request, const char * path) {
+#ifdef ENABLE_EMBEDDED_ASSETS
+    const EmbeddedAsset * embedded = findEmbeddedAsset(path);
+    if(embedded && sendEmbeddedAsset(request, embedded) == OK) return;
+#endif
+
+    // the pages without variables are served like the static assets, but revalidated on each load
+    const StaticAsset * asset = findAsset(path);
+    if(asset && !asset->tmpl) {
+        sendFile(request, path, asset, "no-cache");
+        return;
+    }
+
+    CLHtmlTemplate * tpl = getTemplate(path);
+    if(!tpl) {
+        request->send(404);
+        return;
+    }
+    sendTemplate(request, tpl);
+}
+
+CLHtmlTemplate * CLAppHttpd::getTemplate(const char * path, const uint8_t * data, size_t len) {
+    for(int i=0; i < _templateCount; i++) {
+        if(strcmp(_templates[i].path, path)) continue;
+        // a template file is parsed again if it has changed in the file cache
+        if(!data && _templates[i].tpl.loadFile(path) != OK) return nullptr;
+        return &_templates[i].tpl;
+    }
+
+    if(_templateCount >= MAX_PAGE_TEMPLATES) {
+        ESP_LOGE(tag, "Too many page templates, %s not loaded", path);
+        return nullptr;
+    }
+
+    PageTemplate * page = &_templates[_templateCount];
+    if((data?page->tpl.load(data, len):page->tpl.loadFile(path)) != OK) return nullptr;
+
+    page->path = path;
+    _templateCount++;
+    return &page->tpl;
+}
+
+// values of the template variables
+static const char * getTemplateVar(int var) {
+    static String err;
+    switch(var) {
+        case TPL_CAMNAME: return AppHttpd.getName();
+        case TPL_ERRORTEXT: 
+            err = AppCam.getErr();
+            return err.c_str();
+        case TPL_APPURL: return AppConn.getHTTPUrl();
+        default: return "";
+    }
+}
+
+void CLAppHttpd::sendTemplate(AsyncWebServerRequest *request, CLHtmlTemplate * tpl) {
+    // the page is rendered again only if a variable has changed
+    TemplateBuffer data = tpl->render(getTemplateVar);
+    if(!data) {
+        request->send(500);
+        return;
+    }
+
+    char etag[16];
+    snprintf(etag, sizeof(etag), "\"%08x\"", tpl->getHash());
+    if(sendNotModified(request, etag, "no-cache")) return;
+
+    // the response keeps its own reference, so the page may be rendered again while it is being sent
+    AsyncWebServerResponse *response = request->beginResponse("text/html", data->size(),
+        [data](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+            size_t len = min(maxLen, data->size() - index);
+            memcpy(buffer, data->data() + index, len);
+            return len;
+        });
+    response->addHeader("ETag", etag);
+    response->addHeader("Cache-Control", "no-cache");
+    request->send(response);
+}
+
+#ifdef ENABLE_EMBEDDED_ASSETS
+const EmbeddedAsset * CLAppHttpd::findEmbeddedAsset(const char * path) {
+    for(const EmbeddedAsset & asset : embedded_assets)
+        if(!strcmp(asset.path, path)) return &asset;
+    return nullptr;
+}
+
+int CLAppHttpd::sendEmbeddedAsset(AsyncWebServerRequest *request, const EmbeddedAsset * asset) {
+    // the templates are split in place, without copying them out of the flash
+    if(asset->tmpl) {
+        CLHtmlTemplate * tpl = getTemplate(asset->path, asset->data, asset->len);
+        if(tpl) 
+            sendTemplate(request, tpl);
+        else
+            request->send(500);
+        return OK;
+    }
 
-    String output;
-    serializeJson(jstr, output);
+    // the text assets are embedded gzipped only; a client not accepting it gets the file from 
+    // the file system, if it is there
+    if(asset->gz && !acceptsGzip(request)) {
+        if(Storage.exists(asset->path)) return FAIL;
+        request->send(406);
+        return OK;
+    }
 
-    response->print(output);
-    request->send(response); 
+    // the pages are revalidated on each load, the other assets are kept in the browser cache
+    char cache_control[32];
+    if(!strcmp(asset->content_type, "text/html"))
+        snprintf(cache_control, sizeof(cache_control), "no-cache");
+    else
+        snprintf(cache_control, sizeof(cache_control), "max-age=%u", _static_max_age);
+
+    // the same ETags as of the copies in the file system
+    char etag[STATIC_ASSET_HASH_SIZE + 8];
+    snprintf(etag, sizeof(etag), "\"%s%s\"", asset->hash, (asset->gz?"-gz":""));
+    if(sendNotModified(request, etag, cache_control)) return OK;
+
+    // the asset is copied straight from the flash into the TCP buffer
+    AsyncWebServerResponse *response = request->beginResponse(asset->content_type, asset->len,
+        [asset](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+            size_t len = min(maxLen, asset->len - index);
+            memcpy(buffer, asset->data + index, len);
+            return len;
+        });
+
+    if(asset->gz) {
+        response->addHeader("Content-Encoding", "gzip");
+        response->addHeader("Vary", "Accept-Encoding");
+    }
+    response->addHeader("ETag", etag);
+    response->addHeader("Cache-Control", cache_control);
+    request->send(response);
+    return OK;
 }
+#endif
 
 void onStatus(AsyncWebServerRequest *request) {
-    AsyncResponseStream *response = request->beginResponseStream("application/json");
-    // Do not get attempt to get sensor when in error; causes a panic..
+    AppHttpd.sendCameraStatus(request, true);
+}
 
-    JsonDocument jdoc;
-    JsonObject jstr = jdoc.to<JsonObject>();
+void CLAppHttpd::sendCameraStatus(AsyncWebServerRequest *request, bool full_status) {
+    JsonCache & cache = (full_status?_status_cache:_info_cache);
+    uint32_t generation = CLAppComponent::getGeneration();
 
-    AppHttpd.dumpCameraStatusToJson(jstr);
-    
-    String output;
-    serializeJson(jstr, output);
+    char etag[24];
+    getETag(etag, sizeof(etag), generation);
+
+    if(request->hasHeader("If-None-Match") && request->header("If-None-Match") == etag) {
+        AsyncWebServerResponse *response = request->beginResponse(304);
+        response->addHeader("ETag", etag);
+        request->send(response);
+        return;
+    }
+
+    // the status is serialized once per generation of the settings
+    if(!cache.data || cache.generation != generation) {
+        JsonDocument jdoc;
+        dumpCameraStatusToJson(jdoc.to<JsonObject>(), full_status);
+
+        JsonCacheBuffer data = std::make_shared<std::vector<uint8_t>>(measureJson(jdoc) + 1);
+        data->resize(serializeJson(jdoc, (char*)data->data(), data->size()));
 
-    response->print(output);
+        cache.data = data;
+        cache.generation = generation;
+    }
+
+    // the response keeps its own reference, so the cache may be replaced while it is being sent
+    JsonCacheBuffer data = cache.data;
+    AsyncWebServerResponse *response = request->beginResponse("application/json", data->size(),
+        [data](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+            size_t len = min(maxLen, data->size() - index);
+            memcpy(buffer, data->data() + index, len);
+            return len;
+        });
+    response->addHeader("ETag", etag);
+    response->addHeader("Cache-Control", "no-cache");
     request->send(response);
 }
 
 void onSystemStatus(AsyncWebServerRequest *request) {
-    AsyncResponseStream *response = request->beginResponseStream("application/json");
-
     JsonDocument jdoc;
     JsonObject jstr = jdoc.to<JsonObject>();
 
     AppHttpd.dumpSystemStatusToJson(jstr);
 
-    String output;
-    serializeJson(jstr, output);
-    response->print(output);
-
 #if (CONFIG_LOG_DEFAULT_LEVEL >= CORE_DEBUG_LEVEL )
     Serial.println();
     Serial.println("Dump requested through web");
-    Serial.println(buf);
+    serializeJson(jdoc, Serial);
+    Serial.println();
 #endif
 
-    request->send(response);
+    sendJson(request, jdoc);
 }
 
 void CLAppHttpd::dumpCameraStatusToJson(JsonObject jstr, bool full_status) {
 
+    // only the settings are reported here, so the response can be cached per generation;
+    // the time, RSSI, temperature and serial buffer are reported by /system and /metrics
     jstr[FPSTR(CAM_PNAME)] = getName();
     // jstr["stream_url"] = AppConn.getStreamUrl();
-    AppConn.updateTimeStr();
-    jstr[FPSTR(CONN_LOCAL_TIME)] = AppConn.getLocalTimeStr();
-    jstr[FPSTR(CONN_UP_TIME)] = AppConn.getUpTimeStr();
-    jstr[FPSTR(CONN_RSSI)] = (!AppConn.isAccessPoint()?WiFi.RSSI():(uint8_t)0);
-    jstr[FPSTR(ESP_TEMP_PARAM)] = getTemp();
-    jstr[FPSTR(HTTPD_SERIAL_BUF)] = getSerialBuffer();  
 
     AppCam.saveToJson(jstr, full_status);
 
@@ -527,34 +1569,17 @@ void CLAppHttpd::dumpSystemStatusToJson(JsonObject jstr) {
     jstr[FPSTR(ESP_SDK_VERSION_PARAM)] = ESP.getSdkVersion();
 
     jstr[FPSTR(CONN_LOAD_AS_AP)] = AppConn.isAccessPoint();
-    jstr[FPSTR(CONN_AP_TIMEOUT)] = AppConn.getAPTimeout();
     jstr[FPSTR(CONN_CAPTIVE_PORTAL)] = AppConn.isCaptivePortal();
     jstr[FPSTR(CONN_AP_NAME)] = AppConn.getApName();
-    jstr[FPSTR(CONN_SSID)] = AppConn.getSSID();
 
     jstr[FPSTR(CONN_RSSI)] = (!AppConn.isAccessPoint()?WiFi.RSSI():(uint8_t)0);
     jstr[FPSTR(CONN_BSSID)] = (!AppConn.isAccessPoint()?WiFi.BSSIDstr().c_str():(char*)"");
-    jstr[FPSTR(CONN_DHCP)] = AppConn.isDHCPEnabled();
     jstr[FPSTR(CONN_IP_ADDRESS)] = (AppConn.isAccessPoint()?WiFi.softAPIP().toString().c_str():WiFi.localIP().toString().c_str());
     jstr[FPSTR(CONN_SUBNET)] = (!AppConn.isAccessPoint()?WiFi.subnetMask().toString().c_str():(char*)"");
     jstr[FPSTR(CONN_GATEWAY)] = (!AppConn.isAccessPoint()?WiFi.gatewayIP().toString().c_str():(char*)"");
 
-    jstr[FPSTR(CONN_ST_IP)] = (AppConn.getStaticIP()->ip?AppConn.getStaticIP()->ip->toString().c_str():(char*)"");
-    jstr[FPSTR(CONN_ST_SUBNET)] = (AppConn.getStaticIP()->netmask?AppConn.getStaticIP()->netmask->toString().c_str():(char*)"");
-    jstr[FPSTR(CONN_ST_GATEWAY)] = (AppConn.getStaticIP()->gateway?AppConn.getStaticIP()->gateway->toString().c_str():(char*)"");
-    jstr[FPSTR(CONN_DNS1)] = (AppConn.getStaticIP()->dns1?AppConn.getStaticIP()->dns1->toString().c_str():(char*)"");
-    jstr[FPSTR(CONN_DNS2)] = (AppConn.getStaticIP()->dns2?AppConn.getStaticIP()->dns2->toString().c_str():(char*)"");
-
-    jstr[FPSTR(CONN_AP_IP)] = (AppConn.getAPIP()->ip?AppConn.getAPIP()->ip->toString().c_str():(char*)"");
-    jstr[FPSTR(CONN_AP_SUBNET)] = (AppConn.getAPIP()->netmask?AppConn.getAPIP()->netmask->toString().c_str():(char*)"");
-
-    jstr[FPSTR(CONN_AP_CHANNEL)] = AppConn.getAPChannel();
-    jstr[FPSTR(CONN_AP_DHCP)] = AppConn.isAPDHCP();
-
-    jstr[FPSTR(CONN_MDNS_NAME)] = AppConn.getMDNSname();
-    jstr[FPSTR(CONN_HTTP_PORT)] = AppConn.getHTTPPort();
-
-    jstr[FPSTR(CONN_USER)] = AppConn.getUser();
+    // configured settings of the connection
+    AppConn.getProperties()->saveToJson(jstr);
 
     byte mac[6];
     WiFi.macAddress(mac);
@@ -566,15 +1591,27 @@ void CLAppHttpd::dumpSystemStatusToJson(JsonObject jstr) {
 
     jstr[FPSTR(CONN_LOCAL_TIME)] = AppConn.getLocalTimeStr();
     jstr[FPSTR(CONN_UP_TIME)] = AppConn.getUpTimeStr();
-    jstr[FPSTR(CONN_NTP_SERVER)] = AppConn.getNTPServer();
-    jstr[FPSTR(CONN_GMT_OFFSET)] = AppConn.getGmtOffset_sec();
-    jstr[FPSTR(CONN_DST_OFFSET)] = AppConn.getDaylightOffset_sec();
     
     jstr[FPSTR(HTTPD_ACTIVE_STREAMS)] = AppHttpd.getStreamCount();
     jstr[FPSTR(HTTPD_STREAMS_SERVED)] = AppHttpd.getStreamsServed();
     jstr[FPSTR(HTTPD_IMAGES_SERVED)] = AppCam.getImagesServed();
 
-    jstr[FPSTR(CONN_OTA_ENABLED)] = AppConn.isOTAEnabled();
+    JsonArray jaClients = jstr[FPSTR(HTTPD_STREAM_CLIENTS)].to<JsonArray>();
+    for(int i=0; i < _max_streams; i++) {
+        if(!stream_clients[i].id) continue;
+        JsonObject joClient = jaClients.add<JsonObject>();
+        joClient[FPSTR(HTTPD_CLIENT_ID)] = stream_clients[i].id;
+        joClient[FPSTR(HTTPD_FRAMES_SENT)] = stream_clients[i].sent;
+        joClient[FPSTR(HTTPD_FRAMES_DROPPED)] = stream_clients[i].dropped;
+        joClient[FPSTR(HTTPD_CLIENT_FPS)] = getClientRate(&stream_clients[i]);
+    }
+    jstr[FPSTR(HTTPD_STREAM_RATE)] = (_streamCount > 0?getStreamRate():0);
+
+    JsonObject joJitter = jstr[FPSTR(CAM_FRAME_JITTER)].to<JsonObject>();
+    joJitter[FPSTR(CAM_JITTER_P50)] = AppCam.getFrameJitter(50);
+    joJitter[FPSTR(CAM_JITTER_P90)] = AppCam.getFrameJitter(90);
+    joJitter[FPSTR(CAM_JITTER_P99)] = AppCam.getFrameJitter(99);
+    joJitter[FPSTR(CAM_DEADLINES_SKIPPED)] = AppCam.getDeadlinesSkipped();
 
     jstr[FPSTR(ESP_CPU_FREQ_PARAM)] = ESP.getCpuFreqMHz();
     jstr[FPSTR(ESP_NUM_CORES_PARAM)] = ESP.getChipCores();
@@ -595,25 +1632,82 @@ void CLAppHttpd::dumpSystemStatusToJson(JsonObject jstr) {
     jstr[FPSTR(STORAGE_SIZE)] = Storage.getSize();
     jstr[FPSTR(STORAGE_USED)] = Storage.getUsed();
     jstr[FPSTR(STORAGE_UNITS_STR)] = (Storage.capacityUnits()==STORAGE_UNITS_MB?"MB":"");
+    jstr[FPSTR(STORAGE_CACHE_HITS)] = Storage.getCacheHits();
+    jstr[FPSTR(STORAGE_CACHE_MISSES)] = Storage.getCacheMisses();
+    jstr[FPSTR(STORAGE_CACHE_USED)] = Storage.getCacheUsed();
 
     jstr[FPSTR(HTTPD_SERIAL_BUF)] = getSerialBuffer();
 
 #ifdef ENABLE_MAIL_FEATURE
-    jstr[FPSTR(MAIL_SMTP_SERVER)] = AppMailSender.getSMTPServer();
-    jstr[FPSTR(MAIL_SMTP_PORT)] = AppMailSender.getSMTPPort();
-    jstr[FPSTR(MAIL_FROM)] = AppMailSender.getFrom();
-    jstr[FPSTR(MAIL_TO)] = AppMailSender.getTo();
-    jstr[FPSTR(MAIL_SNAPONSTART)] = AppMailSender.isSnapOnStart();
-    jstr[FPSTR(MAIL_SLEEPONCOMPLETE)] = AppMailSender.isSleepOnComplete();
-    jstr[FPSTR(MAIL_PERIOD)] = AppMailSender.getPeriod();
-    jstr[FPSTR(MAIL_NUM_PERIODS)] = AppMailSender.getNumPeriods();
-    jstr[FPSTR(MAIL_USERNAME)] = AppMailSender.getUser();
+    AppMailSender.getProperties()->saveToJson(jstr);
     AppMailSender.saveStartAtToJson(jstr);
     AppMailSender.saveFinishAtToJson(jstr);
 #endif
 
 }
 
+void printMetric(Print * out, const char * name, const char * type, const char * help, uint64_t value) {
+    out->printf("# HELP %s%s %s\n# TYPE %s%s %s\n%s%s %llu\n", 
+                METRICS_PREFIX, name, help, METRICS_PREFIX, name, type, METRICS_PREFIX, name, value);
+}
+
+void CLAppHttpd::printMetrics(Print * out) {
+    // the 64-bit total can't be read in one access
+    portENTER_CRITICAL(&_counters_lock);
+    uint32_t frames_sent = _framesSent;
+    uint32_t frames_dropped = _framesDropped;
+    uint64_t bytes_sent = _bytesSent;
+    portEXIT_CRITICAL(&_counters_lock);
+
+    printMetric(out, "frames_captured_total", "counter", "Frames captured by the camera", AppCam.getFramesCaptured());
+    printMetric(out, "capture_errors_total", "counter", "Failed frame captures", AppCam.getCaptureErrors());
+    printMetric(out, "ring_drops_total", "counter", "Frames dropped for lack of a free slot in the frame ring", AppCam.getFramesDropped());
+    printMetric(out, "images_served_total", "counter", "Still images served", AppCam.getImagesServed());
+    printMetric(out, "frames_sent_total", "counter", "Frames sent to the stream clients", frames_sent);
+    printMetric(out, "frames_dropped_total", "counter", "Frames dropped for the stream clients", frames_dropped);
+    printMetric(out, "bytes_sent_total", "counter", "Bytes of video sent to the stream clients", bytes_sent);
+    printMetric(out, "deadlines_skipped_total", "counter", "Frame deadlines skipped by the capture", AppCam.getDeadlinesSkipped());
+    printMetric(out, "streams_served_total", "counter", "Video streams closed", _streamsServed);
+    printMetric(out, "active_streams", "gauge", "Video streams open", _streamCount);
+    printMetric(out, "stream_rate_fps", "gauge", "Frame rate of the continuous capture", (_streamCount > 0?getStreamRate():0));
+    printMetric(out, "file_cache_hits_total", "counter", "Files served from the file cache", Storage.getCacheHits());
+    printMetric(out, "file_cache_misses_total", "counter", "Files read from the file system", Storage.getCacheMisses());
+    printMetric(out, "file_cache_bytes", "gauge", "Size of the files in the file cache", Storage.getCacheUsed());
+
+    printMetric(out, "heap_free_bytes", "gauge", "Free internal heap", ESP.getFreeHeap());
+    printMetric(out, "heap_min_free_bytes", "gauge", "Low watermark of the free internal heap", ESP.getMinFreeHeap());
+    printMetric(out, "heap_max_alloc_bytes", "gauge", "Largest free block of the internal heap", ESP.getMaxAllocHeap());
+    if(psramFound()) {
+        printMetric(out, "psram_free_bytes", "gauge", "Free PSRAM", ESP.getFreePsram());
+        printMetric(out, "psram_min_free_bytes", "gauge", "Low watermark of the free PSRAM", ESP.getMinFreePsram());
+    }
+    printMetric(out, "uptime_seconds", "gauge", "Time since boot", esp_timer_get_time() / 1000000);
+
+    out->printf("# HELP %srssi_dbm WiFi signal strength\n# TYPE %srssi_dbm gauge\n%srssi_dbm %d\n", 
+                METRICS_PREFIX, METRICS_PREFIX, METRICS_PREFIX, (!AppConn.isAccessPoint()?WiFi.RSSI():0));
+    out->printf("# HELP %stemperature_celsius Chip temperature\n# TYPE %stemperature_celsius gauge\n%stemperature_celsius %.1f\n", 
+                METRICS_PREFIX, METRICS_PREFIX, METRICS_PREFIX, temperatureRead());
+
+    // latency histograms with cumulative buckets, in seconds
+    out->printf("# HELP %sframe_latency_seconds Latency of the frame path stages\n# TYPE %sframe_latency_seconds histogram\n", 
+                METRICS_PREFIX, METRICS_PREFIX);
+    for(int i=0; i < LATENCY_STAGES; i++) {
+        CLLatencyHistogram & hist = Latency.getStage(i);
+        const char * stage = CLLatencyStats::getStageName(i);
+        uint32_t cumulative = 0;
+        for(int j=0; j < LATENCY_BUCKETS; j++) {
+            cumulative += hist.getCount(j);
+            if(j < LATENCY_BUCKETS - 1)
+                out->printf("%sframe_latency_seconds_bucket{stage=\"%s\",le=\"%g\"} %u\n", 
+                            METRICS_PREFIX, stage, CLLatencyHistogram::getBucketLimit(j) / 1e6, cumulative);
+            else
+                out->printf("%sframe_latency_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %u\n", METRICS_PREFIX, stage, cumulative);
+        }
+        out->printf("%sframe_latency_seconds_sum{stage=\"%s\"} %g\n", METRICS_PREFIX, stage, hist.getSum() / 1e6);
+        out->printf("%sframe_latency_seconds_count{stage=\"%s\"} %u\n", METRICS_PREFIX, stage, cumulative);
+    }
+}
+
 void CLAppHttpd::serialSendCommand(const char *cmd) {
 #ifdef ENABLE_SERIAL_COMMANDS
     Serial.print("^");
@@ -622,8 +1716,29 @@ void CLAppHttpd::serialSendCommand(const char *cmd) {
 }
 
 
+// a numeric setting of httpd.json; the default if it is missing or out of range
+static int32_t rangeSetting(JsonObject jctx, const char * key, int32_t def, int32_t min, int32_t max) {
+    JsonVariant val = jctx[FPSTR(key)];
+    if(val.isNull()) return def;
+    if(!val.is<int32_t>() || val.as<int32_t>() < min || val.as<int32_t>() > max) {
+        ESP_LOGW(AppHttpd.getTag(), "Setting %s out of range [%d, %d], using %d", key, (int)min, (int)max, (int)def);
+        return def;
+    }
+    return val.as<int32_t>();
+}
+
 int CLAppHttpd::loadFromJson(JsonObject jctx, bool full_set) {
-    _max_streams = jctx[FPSTR(HTTPD_MAX_STREAMS)] | 2;
+    _max_streams = rangeSetting(jctx, HTTPD_MAX_STREAMS, 2, 1, MAX_VIDEO_STREAMS);
+    // with no room in the queue every frame would be dropped
+    _stream_queue = rangeSetting(jctx, HTTPD_STREAM_QUEUE, DEFAULT_STREAM_QUEUE, 1, MAX_STREAM_QUEUE);
+    _still_max_age = rangeSetting(jctx, HTTPD_STILL_MAX_AGE, DEFAULT_STILL_MAX_AGE, 0, MAX_STILL_MAX_AGE);
+    // 0 disables the pushes; a shorter interval would keep the status task busy
+    _status_interval = rangeSetting(jctx, HTTPD_STATUS_INTERVAL, DEFAULT_STATUS_INTERVAL, 0, MAX_STATUS_INTERVAL);
+    if(_status_interval > 0 && _status_interval < MIN_STATUS_INTERVAL) {
+        ESP_LOGW(tag, "Setting %s below %d ms, using %d", HTTPD_STATUS_INTERVAL, MIN_STATUS_INTERVAL, DEFAULT_STATUS_INTERVAL);
+        _status_interval = DEFAULT_STATUS_INTERVAL;
+    }
+    _static_max_age = rangeSetting(jctx, HTTPD_STATIC_MAX_AGE, DEFAULT_STATIC_MAX_AGE, 0, MAX_STATIC_MAX_AGE);
 
     JsonArray jaMapping = jctx[FPSTR(HTTPD_MAPPING)].as<JsonArray>();
 
@@ -652,6 +1767,10 @@ int CLAppHttpd::saveToJson(JsonObject jctx, bool full_set) {
     jctx["my_name"] = myName;
 
     jctx[FPSTR(HTTPD_MAX_STREAMS)] = _max_streams;
+    jctx[FPSTR(HTTPD_STREAM_QUEUE)] = _stream_queue;
+    jctx[FPSTR(HTTPD_STILL_MAX_AGE)] = _still_max_age;
+    jctx[FPSTR(HTTPD_STATUS_INTERVAL)] = _status_interval;
+    jctx[FPSTR(HTTPD_STATIC_MAX_AGE)] = _static_max_age;
 
     if(_mappingCount > 0) {
         JsonArray jaMapping = jctx[FPSTR(HTTPD_MAPPING)].to<JsonArray>();
@@ -667,20 +1786,37 @@ int CLAppHttpd::saveToJson(JsonObject jctx, bool full_set) {
 }
 
 
-int CLAppHttpd::addStreamClient(uint32_t client_id) {
+int CLAppHttpd::addStreamClient(uint32_t client_id, int fps) {
     for(int i=0; i < _max_streams; i++) {
-        if(!stream_clients[i]) {
-            stream_clients[i] = client_id;
+        if(!stream_clients[i].id) {
+            portENTER_CRITICAL(&_counters_lock);
+            stream_clients[i].id = client_id;
+            stream_clients[i].sent = 0;
+            stream_clients[i].dropped = 0;
+            stream_clients[i].fps = constrain(fps, 0, 255);
+            stream_clients[i].next_frame = 0;
+            stream_clients[i].sample_partial = true;
+            stream_clients[i].sample_sent = 0;
+            stream_clients[i].sample_dropped = 0;
+            stream_clients[i].sample_bytes = 0;
+            portEXIT_CRITICAL(&_counters_lock);
             return OK;
         }
     }
     return FAIL;
 }
 
+StreamClient * CLAppHttpd::getStreamClient(uint32_t client_id) {
+    for(int i=0; i < _max_streams; i++) {
+        if(stream_clients[i].id == client_id) return &stream_clients[i];
+    }
+    return nullptr;
+}
+
 int CLAppHttpd::removeStreamClient(uint32_t client_id) {
     for(int i=0; i < _max_streams; i++) {
-        if(stream_clients[i] ==  client_id) {
-            stream_clients[i] = 0;
+        if(stream_clients[i].id ==  client_id) {
+            stream_clients[i].id = 0;
             return OK;
         }    
     }
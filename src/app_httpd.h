@@ -3,6 +3,7 @@
 
 #include <esp_task_wdt.h>
 #include <ESPAsyncWebServer.h>
+#include <AsyncJson.h>
 #include <ArduinoJson.h>
 
 #include "app_defines.h"
@@ -12,6 +13,7 @@
 #include "app_cam.h"
 #include "app_pwm.h"
 #include "utils.h"
+#include "html_template.h"
 
 #ifdef ENABLE_MAIL_FEATURE
 #include "app_mail.h"      // Mail client
@@ -25,11 +27,100 @@
 
 #define MAX_VIDEO_STREAMS               5
 
+// default number of frames which can be queued to a stream client before the frames are dropped for it
+#define DEFAULT_STREAM_QUEUE            2
+#define MAX_STREAM_QUEUE                16
+
+// ids of the HTTP MJPEG stream clients are marked with this bit to keep them apart from the WebSocket clients
+#define MJPEG_CLIENT_FLAG               0x80000000
+
+#define MJPEG_BOUNDARY                  "123456789000000000000987654321"
+#define MJPEG_PART_HEADER_SIZE          128
+
+// default maximum age of the latest frame to be served as a still image, milliseconds
+#define DEFAULT_STILL_MAX_AGE           500
+#define MAX_STILL_MAX_AGE               60000
+
+// maximum number of still image requests waiting for a frame at the same time
+#define MAX_STILL_REQUESTS              4
+// a still request waiting longer than this for a frame is answered with 503, milliseconds
+#define STILL_REQUEST_TIMEOUT           (CAM_FRAME_TIMEOUT + CAM_LAMP_SETTLE)
+
+// static assets listed in the manifest generated by scripts/gzip_assets.py when the file system image is built
+#define ASSET_MANIFEST                  "/assets.json"
+#define MAX_STATIC_ASSETS               32
+#define STATIC_ASSET_PATH_SIZE          48
+#define STATIC_ASSET_HASH_SIZE          17
+
+// default lifetime of the static assets in the browser cache, seconds. After it expires, 
+// the browser revalidates the asset with its ETag.
+#define DEFAULT_STATIC_MAX_AGE          86400
+// one year, the longest lifetime the browsers honour
+#define MAX_STATIC_MAX_AGE              31536000
+
+// maximum number of pages kept parsed and rendered in memory
+#define MAX_PAGE_TEMPLATES              8
+
+// prefix of the names in the /metrics output
+#define METRICS_PREFIX                  "esp32cam_"
+
+// sampling interval of the stream statistics for the adaptive stream mode, microseconds
+#define STREAM_SAMPLE_INTERVAL          1000000
+
+// WebSocket messages of the settings channel. The video frames are JPEG images, which start with 0xFF,
+// so the clients can tell the messages apart by the first byte.
+#define WS_SET_PROPERTY                 'v'     // client: 'v', key length, key, value type, value
+#define WS_PROPERTY_UPDATE              'u'     // server, to all clients: 'u', key length, key, value type, value
+#define WS_PROPERTY_ERROR               'e'     // server, to the sender: 'e', error code, key length, key
+#define WS_VALUE_INT                    'i'     // int32, little endian
+#define WS_VALUE_STRING                 's'     // UTF-8, up to the end of the message
+#define WS_VALUE_NONE                   'n'     // write-only setting, the value is not sent
+#define WS_ERROR_UNKNOWN                1       // no setting with the key
+#define WS_ERROR_REJECTED               2       // the value is invalid or has been rejected
+
+// maximum length of a setting key
+#define PROPERTY_KEY_SIZE               32
+
+// WebSocket subscription to the system status. The status is pushed as a text message with the JSON object
+// of /system, first in full and then only with the top-level keys which have changed since the previous push.
+#define WS_STATUS_SUBSCRIBE             'm'     // client: 'm', 1 to subscribe (default) or 0 to unsubscribe
+
+// maximum number of WebSocket clients subscribed to the system status
+#define MAX_STATUS_CLIENTS              4
+
+// default interval of the status pushes, milliseconds. 0 disables the pushes.
+#define DEFAULT_STATUS_INTERVAL         1000
+#define MIN_STATUS_INTERVAL             100
+#define MAX_STATUS_INTERVAL             3600000
+
+// Status task parameters. The task only serializes the status, so it runs at a low priority.
+#ifndef HTTPD_STATUS_TASK_PRIORITY
+#define HTTPD_STATUS_TASK_PRIORITY      1
+#endif
+#define HTTPD_STATUS_TASK_STACK         4096
+
 const char HTTPD_SERIAL_BUF[] PROGMEM = "serial_buf";
 const char HTTPD_ACTIVE_STREAMS[] PROGMEM = "active_streams";
 const char HTTPD_STREAMS_SERVED[] PROGMEM = "prev_streams";
 const char HTTPD_IMAGES_SERVED[] PROGMEM = "img_captured";
 const char HTTPD_MAX_STREAMS[] PROGMEM = "max_streams";
+const char HTTPD_STREAM_QUEUE[] PROGMEM = "stream_queue";
+const char HTTPD_STILL_MAX_AGE[] PROGMEM = "still_max_age";
+const char HTTPD_STREAM_CLIENTS[] PROGMEM = "stream_clients";
+const char HTTPD_CLIENT_ID[] PROGMEM = "id";
+const char HTTPD_FRAMES_SENT[] PROGMEM = "sent";
+const char HTTPD_FRAMES_DROPPED[] PROGMEM = "dropped";
+const char HTTPD_CLIENT_FPS[] PROGMEM = "fps";
+const char HTTPD_STREAM_RATE[] PROGMEM = "stream_rate";
+const char HTTPD_STATUS_INTERVAL[] PROGMEM = "status_interval";
+const char HTTPD_STATIC_MAX_AGE[] PROGMEM = "static_max_age";
+const char HTTPD_ASSET_HASH[] PROGMEM = "hash";
+const char HTTPD_ASSET_GZIP[] PROGMEM = "gz";
+const char HTTPD_ASSET_TEMPLATE[] PROGMEM = "tmpl";
+
+const char HTTPD_MAXAGE_ARG[] PROGMEM = "maxage";
+const char HTTPD_FPS_ARG[] PROGMEM = "fps";
+const char HTTPD_RESET_ARG[] PROGMEM = "reset";
 
 const char HTTPD_MAPPING[] PROGMEM = "mapping";
 const char HTTPD_URI[] PROGMEM = "uri";
@@ -45,13 +136,21 @@ enum StreamResponseEnum {STREAM_SUCCESS,
                          STREAM_CLIENT_NOT_FOUND};
 
 
-String processor(const String& var);
 void onSystemStatus(AsyncWebServerRequest *request);
 void onStatus(AsyncWebServerRequest *request);
 void onInfo(AsyncWebServerRequest *request);
 void onControl(AsyncWebServerRequest *request);
+void onControlBatch(AsyncWebServerRequest *request, JsonVariant &json);
+void onStream(AsyncWebServerRequest *request);
+void onCapture(AsyncWebServerRequest *request);
+void onLatency(AsyncWebServerRequest *request);
+void onMetrics(AsyncWebServerRequest *request);
+void onStaticFile(AsyncWebServerRequest *request);
+void sendJson(AsyncWebServerRequest *request, JsonDocument &jdoc, int code = 200);
 void onWsEvent(AsyncWebSocket * server, AsyncWebSocketClient * client, AwsEventType type, void * arg, uint8_t *data, size_t len);
-void onSnapTimer(TimerHandle_t pxTimer);
+void onFrameReady(void * param, uint32_t seq);
+void onStillTimeout(TimerHandle_t timer);
+void statusTask(void * pvParameters);
 
 
 
@@ -61,6 +160,88 @@ void onSnapTimer(TimerHandle_t pxTimer);
  */
 struct UriMapping { char uri[32]; char path[32];};
 
+/**
+ * @brief Static asset with its content hash and a gzipped copy, if any
+ * 
+ */
+struct StaticAsset {
+    char path[STATIC_ASSET_PATH_SIZE];
+    char hash[STATIC_ASSET_HASH_SIZE];
+    bool gz;
+    bool tmpl;          // page template, rendered with the current values of the variables
+};
+
+/**
+ * @brief Page template, loaded on the first request of the page
+ * 
+ */
+struct PageTemplate {
+    const char * path;
+    CLHtmlTemplate tpl;
+};
+
+/**
+ * @brief Web asset compiled into the firmware by scripts/gzip_assets.py (ENABLE_EMBEDDED_ASSETS)
+ * 
+ */
+struct EmbeddedAsset {
+    const char * path;              // path of the file in the data folder, e.g. /www/js/cam.js
+    const char * content_type;
+    const uint8_t * data;           // in flash
+    size_t len;
+    const char * hash;              // content hash of the original file
+    bool gz;                        // gzipped
+    bool tmpl;                      // page template, rendered with the current values of the variables
+};
+
+/**
+ * @brief Video stream client and its delivery counters
+ * 
+ */
+struct StreamClient { 
+    uint32_t id; 
+    uint32_t sent; 
+    uint32_t dropped;
+    uint8_t fps;            // frame rate requested by the client, 0 for the full frame rate
+    int64_t next_frame;     // time the next frame is due for the client, microseconds
+    // counters of the current sampling interval; partial if the client has joined during the interval
+    bool sample_partial;
+    uint32_t sample_sent;
+    uint32_t sample_dropped;
+    uint32_t sample_bytes;
+};
+
+struct MjpegStream;
+
+/**
+ * @brief Still image request waiting for the next frame of the capture task
+ * 
+ */
+struct StillRequest {
+    AsyncWebServerRequest * request;    // HTTP request, nullptr for a WebSocket client
+    uint32_t id;                        // WebSocket client
+    uint32_t after_seq;                 // answered with the first frame newer than this
+    int64_t since;                      // time the request was queued, microseconds
+};
+
+/**
+ * @brief WebSocket client subscribed to the system status
+ * 
+ */
+struct StatusClient {
+    uint32_t id;
+    bool full;              // the client is to receive the full status with the next push
+};
+
+/**
+ * @brief Serialized JSON response, valid for one generation of the settings
+ * 
+ */
+using JsonCacheBuffer = std::shared_ptr<std::vector<uint8_t>>;
+struct JsonCache {
+    uint32_t generation;
+    JsonCacheBuffer data;
+};
 
 /** 
  * @brief WebServer Manager
@@ -79,8 +260,33 @@ class CLAppHttpd : public CLAppComponent {
         void cleanupWsClients();
 
         // register a client streaming video
-        int addStreamClient(uint32_t client_id);
+        int addStreamClient(uint32_t client_id, int fps = 0);
         int removeStreamClient(uint32_t client_id);
+        StreamClient * getStreamClient(uint32_t client_id);
+
+        // frame rate delivered to the client
+        int getClientRate(StreamClient * sc);
+
+        /// @brief decimates the stream for a client requesting a lower rate than the stream rate
+        /// @param sc stream client
+        /// @param timestamp capture time of the frame, microseconds
+        /// @return true if the frame is to be sent to the client
+        bool isFrameDue(StreamClient * sc, int64_t timestamp);
+
+        // update the counters of the client and the totals
+        void frameSent(StreamClient * sc, size_t bytes);
+        void frameDropped(StreamClient * sc, uint32_t count = 1);
+
+        // rate of the stream scheduler, the highest rate requested by the stream clients
+        int getStreamRate() {return AppCam.getCaptureRate();};
+
+        uint32_t getStillMaxAge() {return _still_max_age;};
+
+        // ETag of a frame or a settings generation, unique across reboots
+        void getETag(char * buf, size_t len, uint32_t seq) {snprintf(buf, len, "\"%08x-%u\"", _boot_id, seq);};
+
+        // id for the next HTTP MJPEG stream client
+        uint32_t nextMjpegClientId() {return MJPEG_CLIENT_FLAG | (++_mjpeg_clients);};
 
         uint32_t getControlClient() {return _control_client;};
         void setControlClient(uint32_t id) {_control_client = id;};
@@ -89,13 +295,72 @@ class CLAppHttpd : public CLAppComponent {
         long getStreamsServed() {return _streamsServed;};
 
         // start stream
-        StreamResponseEnum startStream(uint32_t id, CaptureModeEnum stream_mode);
+        StreamResponseEnum startStream(uint32_t id, CaptureModeEnum stream_mode, int fps = 0);
         //terminate stream
         StreamResponseEnum stopStream(uint32_t id);
 
-        int bcastBufImg(uint8_t* buffer, size_t size);
-
-        void setFrameRate(int frameRate);
+        // send the latest frame from the capture ring to the stream clients
+        int bcastFrame();
+
+        // HTTP MJPEG streams waiting for a frame are resumed by the frame fan-out
+        int registerMjpegStream(MjpegStream * stream);
+        void unregisterMjpegStream(MjpegStream * stream);
+        void wakeMjpegStreams();
+
+        /// @brief queues a still image request to be answered with the next frame, so the network task 
+        /// doesn't wait for the capture
+        /// @param request HTTP request, or nullptr for the WebSocket client id
+        /// @return OK(0) or FAIL(1) if too many requests are waiting
+        int queueStill(AsyncWebServerRequest * request, uint32_t id = 0);
+        void cancelStill(AsyncWebServerRequest * request);
+        /// @brief answers the waiting still requests with the latest frame if it is new to them, 
+        /// and with 503 those waiting too long
+        /// @param failed the single capture has failed, so no frame follows
+        void serveStills(bool failed);
+
+        // serializes the calls into the responses between the network task and the frame fan-out
+        void lockResponses() {if(_response_lock) xSemaphoreTakeRecursive(_response_lock, portMAX_DELAY);};
+        void unlockResponses() {if(_response_lock) xSemaphoreGiveRecursive(_response_lock);};
+
+        // pass the statistics of the slowest stream client to the adaptive stream controller
+        void sampleStreams();
+
+        // re-calculates the stream rate after a client has joined or left
+        void updateStreamRate();
+
+        /// @brief finds a setting of the application components by its key
+        /// @param registry set to the property registry of the component owning the setting
+        /// @param rank set to the position of the component in the order the settings are applied in
+        /// @return definition of the setting or nullptr if no component has it
+        const PropertyDef * findProperty(const char * key, CLPropertyRegistry ** registry = nullptr, int * rank = nullptr);
+
+        /// @brief validates a set of settings and, if all of them are valid, applies them in the order 
+        /// of the property tables (e.g. framesize before quality), skipping the ones which are unchanged
+        /// @param jctx settings, key-value pairs
+        /// @param results result of each setting (ok, unknown, invalid, failed or skipped)
+        /// @return number of the settings which are invalid or have failed to apply
+        int setProperties(JsonObject jctx, JsonObject results);
+
+        /// @brief handles a WS_SET_PROPERTY message of a WebSocket client
+        void onWsSetProperty(AsyncWebSocketClient * client, const uint8_t * msg, size_t len);
+
+        /// @brief serves a page, from the firmware if it is embedded, from the file system otherwise
+        void sendPage(AsyncWebServerRequest *request, const char * path);
+
+        /// @brief serves a file from the folders of the URI mappings. The assets listed in the manifest are sent 
+        /// gzipped if the client accepts it, with their hash as ETag and a long lifetime in the browser cache.
+        void sendStaticFile(AsyncWebServerRequest *request);
+
+        // pushes the current value of a setting to all WebSocket clients
+        void notifyProperty(const PropertyDef * prop);
+
+        /// @brief subscribes a WebSocket client to the system status pushes
+        /// @return OK(0) or FAIL(1) if the pushes are disabled or there are too many subscribers
+        int subscribeStatus(uint32_t client_id);
+        void unsubscribeStatus(uint32_t client_id);
+
+        // sends the status to the subscribers every status interval; runs in the status task
+        void statusLoop();
 
         void serialSendCommand(const char * cmd);
 
@@ -111,8 +376,14 @@ class CLAppHttpd : public CLAppComponent {
         char * getSerialBuffer() {return serialBuffer;};
 
         void dumpSystemStatusToJson(JsonObject jstr);
+
+        // prints the counters and gauges in the Prometheus text exposition format
+        void printMetrics(Print * out);
         void dumpCameraStatusToJson(JsonObject jstr, bool full = true);
 
+        // sends the camera status from the cache, or 304 if the client has the current generation
+        void sendCameraStatus(AsyncWebServerRequest *request, bool full_status);
+
         uint8_t getTemp() {return temperatureRead();};
         
     private:
@@ -120,6 +391,42 @@ class CLAppHttpd : public CLAppComponent {
         UriMapping *mappingList[MAX_URI_MAPPINGS]; 
         int _mappingCount=0;
 
+        StaticAsset * _assets = nullptr;
+        int _assetCount = 0;
+
+        // lifetime of the static assets in the browser cache, seconds
+        uint32_t _static_max_age = DEFAULT_STATIC_MAX_AGE;
+
+        PageTemplate _templates[MAX_PAGE_TEMPLATES] = {};
+        int _templateCount = 0;
+
+        // loads the manifest of the static assets
+        int loadAssets();
+
+        const StaticAsset * findAsset(const char * path);
+
+        // sends a file of the manifest, gzipped if the client accepts it
+        void sendFile(AsyncWebServerRequest *request, const String & path, const StaticAsset * asset, 
+                      const char * cache_control);
+
+        /// @brief finds a page template, loading it on first use from the data passed or from the file system
+        /// @return template or nullptr if it can't be loaded
+        CLHtmlTemplate * getTemplate(const char * path, const uint8_t * data = nullptr, size_t len = 0);
+
+        // sends the rendered page with its length and ETag
+        void sendTemplate(AsyncWebServerRequest *request, CLHtmlTemplate * tpl);
+
+        // sends 304 if the client has the version of the asset with the ETag
+        // @return true if the response has been sent
+        bool sendNotModified(AsyncWebServerRequest *request, const char * etag, const char * cache_control);
+
+#ifdef ENABLE_EMBEDDED_ASSETS
+        const EmbeddedAsset * findEmbeddedAsset(const char * path);
+        /// @brief sends an asset compiled into the firmware
+        /// @return OK(0) or FAIL(1) if the client doesn't accept the gzipped asset and it is to be sent from the file system
+        int sendEmbeddedAsset(AsyncWebServerRequest *request, const EmbeddedAsset * asset);
+#endif
+
 
         // Name of the application used in web interface
         // Can be re-defined in the httpd.json file
@@ -131,18 +438,65 @@ class CLAppHttpd : public CLAppComponent {
         AsyncWebSocket *ws; 
         
         // array of clients currently streaming video 
-        uint32_t stream_clients[MAX_VIDEO_STREAMS];
+        StreamClient stream_clients[MAX_VIDEO_STREAMS];
 
         uint32_t _control_client;
         
-        TimerHandle_t _stream_timer = NULL;
-
         int8_t _streamCount=0;
 
+        // sequence number of the last frame broadcasted to the stream clients
+        uint32_t _last_frame_seq = 0;
+
+        // start of the current sampling interval of the stream statistics
+        int64_t _sample_start = 0;
+
+        // number of HTTP MJPEG streams opened since start
+        uint32_t _mjpeg_clients = 0;
+
+        // open HTTP MJPEG streams and still requests waiting for a frame, and the lock of their responses
+        MjpegStream * _mjpeg_streams[MAX_VIDEO_STREAMS] = {nullptr};
+        StillRequest _still_requests[MAX_STILL_REQUESTS] = {};
+        // expires the still requests when no frame comes
+        TimerHandle_t _still_timer = NULL;
+        SemaphoreHandle_t _response_lock = NULL;
+
+        // random id of this boot; makes the ETags unique across reboots
+        uint32_t _boot_id = 0;
+
+        // serialized /status and /info responses
+        JsonCache _status_cache = {0, nullptr};
+        JsonCache _info_cache = {0, nullptr};
+
+        // WebSocket clients subscribed to the system status, and the status sent to them last
+        StatusClient _status_clients[MAX_STATUS_CLIENTS] = {};
+        portMUX_TYPE _status_lock = portMUX_INITIALIZER_UNLOCKED;
+        JsonDocument _status_last;
+        TaskHandle_t _status_task = NULL;
+
+        // interval of the status pushes, ms
+        uint32_t _status_interval = DEFAULT_STATUS_INTERVAL;
+
+        // sends the full status to the new subscribers and the changes since the last push to the others
+        void pushStatus();
+
         long _streamsServed=0;
 
+        // totals over all stream clients since start
+        uint32_t _framesSent = 0;
+        uint32_t _framesDropped = 0;
+        uint64_t _bytesSent = 0;
+        // guards the totals and the counters of the stream clients, updated from the frame fan-out and the network task
+        portMUX_TYPE _counters_lock = portMUX_INITIALIZER_UNLOCKED;
+
         // maximum number of parallel video streams supported. This number can range from 1 to MAX_VIDEO_STREAMS
         int _max_streams=2;
+
+        // maximum number of frames queued to a stream client. Frames are skipped for the client 
+        // while its queue is full, so a slow client doesn't add latency for the others
+        int _stream_queue=DEFAULT_STREAM_QUEUE;
+
+        // maximum age of the latest frame to be served as a still image instead of capturing a new one, ms
+        uint32_t _still_max_age=DEFAULT_STILL_MAX_AGE;
         
         // Sketch Info
         int _sketchSize ;
@@ -1,5 +1,50 @@
 #include "app_mail.h"
 
+static int mail_set_smtp_server(const char * val) {AppMailSender.setSMTPServer(val); return OK;}
+static const char * mail_get_smtp_server() {return AppMailSender.getSMTPServer();}
+static int mail_set_smtp_port(int val) {AppMailSender.setSMTPPort(val); return OK;}
+static int mail_get_smtp_port() {return AppMailSender.getSMTPPort();}
+static int mail_set_from(const char * val) {AppMailSender.setFrom(val); return OK;}
+static const char * mail_get_from() {return AppMailSender.getFrom();}
+static int mail_set_to(const char * val) {AppMailSender.setTo(val); return OK;}
+static const char * mail_get_to() {return AppMailSender.getTo();}
+static int mail_set_snaponstart(int val) {AppMailSender.setSnapOnStart(val); return OK;}
+static int mail_get_snaponstart() {return AppMailSender.isSnapOnStart();}
+static int mail_set_sleeponcomplete(int val) {AppMailSender.setSleepOnComplete(val); return OK;}
+static int mail_get_sleeponcomplete() {return AppMailSender.isSleepOnComplete();}
+static int mail_set_period(int val) {AppMailSender.setPeriod(val); return OK;}
+static int mail_get_period() {return AppMailSender.getPeriod();}
+static int mail_set_num_periods(int val) {AppMailSender.setNumPeriods(val); return OK;}
+static int mail_get_num_periods() {return AppMailSender.getNumPeriods();}
+static int mail_set_user(const char * val) {AppMailSender.setUser(val); return OK;}
+static const char * mail_get_user() {return AppMailSender.getUser();}
+static int mail_set_pwd(const char * val) {AppMailSender.setPwd(val); return OK;}
+static int mail_set_start(const char * val) {AppMailSender.setStartAt(val); return OK;}
+static int mail_set_finish(const char * val) {AppMailSender.setFinishAt(val); return OK;}
+
+// Properties of the mail sender. The registry saves them for the system status only, the preferences
+// hold the message texts as well. The password is write-only, the schedule times are formatted by
+// saveStartAtToJson() and saveFinishAtToJson().
+static constexpr PropertyDef mail_properties[] = {
+    strProperty(MAIL_SMTP_SERVER, PROP_SAVE, mail_set_smtp_server, mail_get_smtp_server),
+    intProperty(MAIL_SMTP_PORT, 1, 65535, PROP_SAVE, mail_set_smtp_port, mail_get_smtp_port),
+    strProperty(MAIL_FROM, PROP_SAVE, mail_set_from, mail_get_from),
+    strProperty(MAIL_TO, PROP_SAVE, mail_set_to, mail_get_to),
+    boolProperty(MAIL_SNAPONSTART, PROP_SAVE, mail_set_snaponstart, mail_get_snaponstart),
+    boolProperty(MAIL_SLEEPONCOMPLETE, PROP_SAVE, mail_set_sleeponcomplete, mail_get_sleeponcomplete),
+    intProperty(MAIL_PERIOD, TimePeriod::NONE, TimePeriod::WEEK, PROP_SAVE, mail_set_period, mail_get_period),
+    intProperty(MAIL_NUM_PERIODS, 0, 65535, PROP_SAVE, mail_set_num_periods, mail_get_num_periods),
+    strProperty(MAIL_USERNAME, PROP_SAVE, mail_set_user, mail_get_user),
+    strProperty(MAIL_PASSWORD, 0, mail_set_pwd, nullptr),
+    strProperty(MAIL_START_AT, 0, mail_set_start, nullptr),
+    strProperty(MAIL_FINISH_AT, 0, mail_set_finish, nullptr)
+};
+
+CLAppMailSender::CLAppMailSender() : properties(mail_properties) {
+    setTag("mail");
+    ms_on_send = 0;
+}
+
 MailSharedBuffer makeSharedBuffer(const uint8_t *message, size_t len) {
   auto buffer = std::make_shared<std::vector<uint8_t>>(len);
   std::memcpy(buffer->data(), message, len);
@@ -177,6 +222,8 @@ void CLAppMailSender::scheduleNext() {
     if(seconds_till_fire) {
         if(sleeponcomplete) {
             ESP_LOGI(tag, "Going to hibernate for %lu seconds", seconds_till_fire);
+            flushPrefs();
+            AppCam.saveSleepState();
             hibernate(seconds_till_fire);
         }
         else {
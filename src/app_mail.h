@@ -47,16 +47,15 @@ const char MAIL_IMG_FILENAME[] PROGMEM = "photo.jpg";
 
 class CLAppMailSender : public CLAppComponent {
     public:
-        CLAppMailSender() {
-            setTag("mail");
-            ms_on_send = 0;
-        };
+        CLAppMailSender();
 
         int start();
         void process();
 
         int loadFromJson(JsonObject jctx, bool full_set = true);
         int saveToJson(JsonObject jctx, bool full_set = true);
+
+        CLPropertyRegistry * getProperties() {return &properties;};
     
         int mailImage();
         int storeBufImg(uint8_t* buffer, size_t size);
@@ -148,6 +147,9 @@ class CLAppMailSender : public CLAppComponent {
         MailSharedBuffer img_buffer;
         bool img_in_buffer = false;
 
+        // settings which can be changed at runtime
+        CLPropertyRegistry properties;
+
 };
 
 extern CLAppMailSender AppMailSender;
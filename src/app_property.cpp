@@ -0,0 +1,140 @@
+#include "app_property.h"
+
+CLPropertyRegistry::CLPropertyRegistry(const PropertyDef * defs, size_t count) : defs(defs), count(count) {
+    memset(index, PROPERTY_INDEX_EMPTY, sizeof(index));
+
+    if(count >= PROPERTY_INDEX_SIZE) {
+        ESP_LOGE(tag, "Too many properties (%d) for the index", (int)count);
+        this->count = count = PROPERTY_INDEX_SIZE - 1;
+    }
+
+    // open addressing with linear probing
+    for(size_t i=0; i < count; i++) {
+        uint32_t pos = defs[i].hash & (PROPERTY_INDEX_SIZE - 1);
+        while(index[pos] != PROPERTY_INDEX_EMPTY) pos = (pos + 1) & (PROPERTY_INDEX_SIZE - 1);
+        index[pos] = i;
+    }
+}
+
+const PropertyDef * CLPropertyRegistry::find(const char * key) {
+    if(!key) return nullptr;
+
+    uint32_t hash = propertyHash(key);
+    uint32_t pos = hash & (PROPERTY_INDEX_SIZE - 1);
+    while(index[pos] != PROPERTY_INDEX_EMPTY) {
+        const PropertyDef * prop = &defs[index[pos]];
+        if(prop->hash == hash && !strcmp(prop->key, key)) return prop;
+        pos = (pos + 1) & (PROPERTY_INDEX_SIZE - 1);
+    }
+    return nullptr;
+}
+
+int CLPropertyRegistry::set(const PropertyDef * prop, const char * val) {
+    if(!prop || !val) return FAIL;
+
+    if(prop->type == PROP_STRING)
+        return (prop->set_str?prop->set_str(val):FAIL);
+
+    char * end;
+    long ival = strtol(val, &end, 10);
+    if(end == val || *end) return FAIL;
+
+    return setInt(prop, ival);
+}
+
+int CLPropertyRegistry::setInt(const PropertyDef * prop, int val) {
+    if(!prop || !prop->set || prop->type == PROP_STRING) return FAIL;
+    if(val < prop->min || val > prop->max) return FAIL;
+
+    return (prop->set(val)?FAIL:OK);
+}
+
+int CLPropertyRegistry::toInt(JsonVariantConst val, int * out) {
+    if(val.is<bool>()) *out = val.as<bool>();
+    else if(val.is<int>()) *out = val.as<int>();
+    else if(val.is<const char*>()) {
+        // numbers passed as strings, like in the query string of /control
+        const char * str = val.as<const char*>();
+        char * end;
+        *out = strtol(str, &end, 10);
+        if(end == str || *end) return FAIL;
+    }
+    else return FAIL;
+
+    return OK;
+}
+
+int CLPropertyRegistry::setJson(const PropertyDef * prop, JsonVariantConst val) {
+    if(!prop || val.isNull()) return FAIL;
+
+    if(prop->type == PROP_STRING)
+        return (val.is<const char*>() && prop->set_str?prop->set_str(val.as<const char*>()):FAIL);
+
+    int ival;
+    if(toInt(val, &ival) != OK) return FAIL;
+
+    return setInt(prop, ival);
+}
+
+int CLPropertyRegistry::validate(const PropertyDef * prop, JsonVariantConst val) {
+    if(!prop || val.isNull()) return FAIL;
+
+    if(prop->type == PROP_STRING)
+        return (val.is<const char*>() && prop->set_str?OK:FAIL);
+
+    int ival;
+    if(!prop->set || toInt(val, &ival) != OK) return FAIL;
+
+    return (ival < prop->min || ival > prop->max?FAIL:OK);
+}
+
+bool CLPropertyRegistry::isCurrent(const PropertyDef * prop, JsonVariantConst val) {
+    if(!prop) return false;
+
+    if(prop->type == PROP_STRING)
+        return (prop->get_str && val.is<const char*>() && !strcmp(prop->get_str(), val.as<const char*>()));
+
+    int ival;
+    return (prop->get && toInt(val, &ival) == OK && prop->get() == ival);
+}
+
+void CLPropertyRegistry::getJson(const PropertyDef * prop, JsonObject jctx) {
+    if(!prop) return;
+
+    switch(prop->type) {
+        case PROP_STRING:
+            if(prop->get_str) jctx[prop->key] = prop->get_str();
+            break;
+        case PROP_BOOL:
+            if(prop->get) jctx[prop->key] = (bool)prop->get();
+            break;
+        default:
+            if(prop->get) jctx[prop->key] = prop->get();
+            break;
+    }
+}
+
+int CLPropertyRegistry::loadFromJson(JsonObject jctx) {
+    int failed = 0;
+    for(size_t i=0; i < count; i++) {
+        if(!(defs[i].flags & PROP_LOAD)) continue;
+
+        JsonVariantConst val = jctx[defs[i].key];
+        if(val.isNull()) continue;
+
+        if(setJson(&defs[i], val) != OK) {
+            ESP_LOGW(tag, "Failed to load %s", defs[i].key);
+            failed++;
+        }
+    }
+    return failed;
+}
+
+void CLPropertyRegistry::saveToJson(JsonObject jctx, bool full_set) {
+    for(size_t i=0; i < count; i++) {
+        if(!(defs[i].flags & PROP_SAVE)) continue;
+        if(!full_set && !(defs[i].flags & PROP_INFO)) continue;
+
+        getJson(&defs[i], jctx);
+    }
+}
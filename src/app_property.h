@@ -0,0 +1,139 @@
+#ifndef app_property_h
+#define app_property_h
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#include <esp_log.h>
+
+// Size of the hash index of a property registry, power of 2. Keep the load factor below 3/4.
+#ifndef PROPERTY_INDEX_SIZE
+#define PROPERTY_INDEX_SIZE             64
+#endif
+
+#define PROPERTY_INDEX_EMPTY            0xFF
+
+// property flags
+#define PROP_LOAD                       0x01    // set by loadFromJson() of the registry
+#define PROP_SAVE                       0x02    // written by saveToJson() of the registry
+#define PROP_PERSIST                    (PROP_LOAD | PROP_SAVE)
+#define PROP_INFO                       0x04    // written in the short set (/info) as well
+
+// maximum number of settings in a batch
+#ifndef PROPERTY_BATCH_SIZE
+#define PROPERTY_BATCH_SIZE             64
+#endif
+
+enum PropertyTypeEnum {PROP_INT, PROP_BOOL, PROP_STRING};
+
+// results of the settings in a batch
+const char PROP_RESULT_OK[] PROGMEM = "ok";
+const char PROP_RESULT_UNKNOWN[] PROGMEM = "unknown";
+const char PROP_RESULT_INVALID[] PROGMEM = "invalid";
+const char PROP_RESULT_FAILED[] PROGMEM = "failed";
+const char PROP_RESULT_SKIPPED[] PROGMEM = "skipped";
+
+typedef int (*PropertyIntSetter)(int val);
+typedef int (*PropertyIntGetter)();
+typedef int (*PropertyStrSetter)(const char * val);
+typedef const char * (*PropertyStrGetter)();
+
+/**
+ * @brief FNV-1a hash of a property key, evaluated at compile time for the registry tables
+ */
+constexpr uint32_t propertyHash(const char * key, uint32_t hash = 2166136261u) {
+    return (*key?propertyHash(key + 1, (hash ^ (uint8_t)*key) * 16777619u):hash);
+}
+
+/**
+ * @brief Definition of a setting exposed by a component. The tables of definitions are constexpr,
+ * so they are kept in flash. A property without a setter is read-only, without a getter write-only.
+ */
+struct PropertyDef {
+    const char * key;
+    uint32_t hash;
+    PropertyTypeEnum type;
+    int32_t min;
+    int32_t max;
+    uint8_t flags;
+    PropertyIntSetter set;
+    PropertyIntGetter get;
+    PropertyStrSetter set_str;
+    PropertyStrGetter get_str;
+};
+
+constexpr PropertyDef intProperty(const char * key, int32_t min, int32_t max, uint8_t flags,
+                                  PropertyIntSetter set, PropertyIntGetter get) {
+    return {key, propertyHash(key), PROP_INT, min, max, flags, set, get, nullptr, nullptr};
+}
+
+constexpr PropertyDef boolProperty(const char * key, uint8_t flags, PropertyIntSetter set, PropertyIntGetter get) {
+    return {key, propertyHash(key), PROP_BOOL, 0, 1, flags, set, get, nullptr, nullptr};
+}
+
+constexpr PropertyDef strProperty(const char * key, uint8_t flags, PropertyStrSetter set, PropertyStrGetter get) {
+    return {key, propertyHash(key), PROP_STRING, 0, 0, flags, nullptr, nullptr, set, get};
+}
+
+/**
+ * @brief Registry of the properties of a component
+ * Dispatches the settings by key through a hash index built once at start, and generates the JSON
+ * load and save of the component from the same table, so a key can't be missing from either of them.
+ * The order of the table is the order the properties are loaded and saved in.
+ */
+class CLPropertyRegistry {
+    public:
+        template<size_t N>
+        CLPropertyRegistry(const PropertyDef (&defs)[N]) : CLPropertyRegistry(defs, N) {};
+        CLPropertyRegistry(const PropertyDef * defs, size_t count);
+
+        /// @brief finds a property by its key
+        /// @return definition of the property or nullptr if not found
+        const PropertyDef * find(const char * key);
+
+        /// @brief sets a property from its text representation (as received in a request)
+        /// @return OK(0) or FAIL(1) if the value is invalid, out of range or rejected by the component
+        int set(const PropertyDef * prop, const char * val);
+
+        /// @brief sets an integer or boolean property
+        /// @return OK(0) or FAIL(1)
+        int setInt(const PropertyDef * prop, int val);
+
+        /// @brief sets a property from a JSON value
+        /// @return OK(0) or FAIL(1)
+        int setJson(const PropertyDef * prop, JsonVariantConst val);
+
+        /// @brief checks a JSON value against the type and the range of the property without applying it
+        /// @return OK(0) or FAIL(1)
+        int validate(const PropertyDef * prop, JsonVariantConst val);
+
+        /// @brief checks if the property has the value already
+        /// @return true if the getter of the property reports the value, false if it differs or can't be read
+        bool isCurrent(const PropertyDef * prop, JsonVariantConst val);
+
+        /// @brief adds the current value of the property to the JSON object
+        void getJson(const PropertyDef * prop, JsonObject jctx);
+
+        /// @brief sets the properties marked with PROP_LOAD which are present in the JSON object
+        /// @return number of the properties which failed to load
+        int loadFromJson(JsonObject jctx);
+
+        /// @brief adds the properties marked with PROP_SAVE (PROP_INFO as well, if not full_set)
+        void saveToJson(JsonObject jctx, bool full_set = true);
+
+        size_t size() {return count;};
+        const PropertyDef * at(size_t i) {return &defs[i];};
+
+    private:
+        // converts a JSON value of an integer or boolean property; strings are parsed as numbers
+        int toInt(JsonVariantConst val, int * out);
+
+        const PropertyDef * defs;
+        size_t count;
+
+        uint8_t index[PROPERTY_INDEX_SIZE];
+
+        const char * tag = "props";
+};
+
+#endif
@@ -0,0 +1,107 @@
+#include "frame_pacer.h"
+
+#include <algorithm>
+
+int CLFramePacer::init(TaskHandle_t task, uint32_t notify_bit) {
+    this->task = task;
+    this->notify_bit = notify_bit;
+
+    esp_timer_create_args_t args = {};
+    args.callback = onDeadline;
+    args.arg = this;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "FramePacer";
+
+    if(esp_timer_create(&args, &timer) != ESP_OK) {
+        ESP_LOGE(tag, "Failed to create the deadline timer");
+        return FAIL;
+    }
+    return OK;
+}
+
+void CLFramePacer::onDeadline(void * arg) {
+    CLFramePacer * pacer = (CLFramePacer*) arg;
+    xTaskNotify(pacer->task, pacer->notify_bit, eSetBits);
+}
+
+void CLFramePacer::start(int rate) {
+    this->rate = (rate > 0?rate:1);
+    origin = esp_timer_get_time();
+    next = 0;
+    gap = true;
+    // drop a deadline of the previous session which has fired after it was stopped
+    ulTaskNotifyValueClear(task, notify_bit);
+    running = true;
+}
+
+void CLFramePacer::stop() {
+    if(timer) esp_timer_stop(timer);
+    running = false;
+}
+
+void CLFramePacer::setRate(int rate) {
+    if(rate <= 0) rate = 1;
+    if(rate == this->rate) return;
+
+    // the next deadline is one new period after the last one
+    if(next > 0) {
+        origin = getDeadline(next - 1);
+        next = 1;
+    }
+    this->rate = rate;
+    gap = true;
+}
+
+int64_t IRAM_ATTR CLFramePacer::wait() {
+    int64_t now = esp_timer_get_time();
+
+    // index of the last deadline which has passed already; the ones before it are skipped
+    if(now >= origin) {
+        int64_t passed = (now - origin) * rate / 1000000;
+        if(passed > next) {
+            skipped += passed - next;
+            next = passed;
+            gap = true;
+        }
+    }
+
+    int64_t deadline = getDeadline(next++);
+    if(deadline <= now || !timer) return deadline;
+
+    esp_timer_stop(timer);
+    if(esp_timer_start_once(timer, deadline - now) != ESP_OK) {
+        vTaskDelay(pdMS_TO_TICKS((deadline - now) / 1000));
+        return deadline;
+    }
+
+    // other notification bits of the task don't end the wait; the timeout is a safety net only
+    TickType_t timeout = pdMS_TO_TICKS((deadline - now) / 1000) + 2;
+    TickType_t start = xTaskGetTickCount();
+    uint32_t events = 0;
+    while(!(events & notify_bit) && xTaskGetTickCount() - start < timeout) {
+        xTaskNotifyWait(0, notify_bit, &events, timeout - (xTaskGetTickCount() - start));
+    }
+    return deadline;
+}
+
+void IRAM_ATTR CLFramePacer::frameDone(int64_t timestamp) {
+    if(!gap && last_frame) {
+        int64_t deviation = timestamp - last_frame - 1000000 / rate;
+        samples[sample_pos] = (uint32_t)(deviation < 0?-deviation:deviation);
+        sample_pos = (sample_pos + 1) % FRAME_JITTER_SAMPLES;
+        if(sample_count < FRAME_JITTER_SAMPLES) sample_count++;
+    }
+    gap = false;
+    last_frame = timestamp;
+}
+
+uint32_t CLFramePacer::getJitter(int pct) {
+    if(!sample_count) return 0;
+
+    uint32_t sorted[FRAME_JITTER_SAMPLES];
+    uint16_t count = sample_count;
+    memcpy(sorted, samples, count * sizeof(uint32_t));
+    std::sort(sorted, sorted + count);
+
+    return sorted[(count - 1) * constrain(pct, 0, 100) / 100];
+}
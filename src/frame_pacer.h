@@ -0,0 +1,84 @@
+#ifndef frame_pacer_h
+#define frame_pacer_h
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+
+#include <esp_log.h>
+
+// Number of the most recent inter-frame intervals kept for the jitter percentiles
+#ifndef FRAME_JITTER_SAMPLES
+#define FRAME_JITTER_SAMPLES            128
+#endif
+
+/**
+ * @brief Frame pacing scheduler
+ * Frame n of a pacing session is due at start + n * 1000000 / rate microseconds, so the configured
+ * rate is held exactly, independent of the FreeRTOS tick rate, and an overrun of one frame doesn't
+ * shift the later ones. Deadlines which have passed while a frame was being captured are skipped
+ * instead of being caught up in a burst.
+ * The waiting task is woken by an esp_timer, which sets a notification bit of the task.
+ */
+class CLFramePacer {
+    public:
+        /// @brief creates the deadline timer
+        /// @param task task calling wait()
+        /// @param notify_bit notification bit of the task reserved for the pacer
+        /// @return OK(0) or FAIL(1)
+        int init(TaskHandle_t task, uint32_t notify_bit);
+
+        /// @brief starts a new pacing session; the first deadline is now
+        void start(int rate);
+        void stop();
+        bool isRunning() {return running;};
+
+        /// @brief changes the rate of a running session, keeping the phase of the last deadline
+        void setRate(int rate);
+        int getRate() {return rate;};
+
+        /// @brief waits for the next deadline
+        /// @return deadline the frame is due at, microseconds since boot
+        int64_t IRAM_ATTR wait();
+
+        /// @brief records the capture time of a frame for the jitter statistics
+        void IRAM_ATTR frameDone(int64_t timestamp);
+
+        /// @brief percentile of the inter-frame jitter over the last FRAME_JITTER_SAMPLES frames
+        /// @param pct percentile, 0 - 100
+        /// @return absolute deviation of the inter-frame interval from the frame period, microseconds
+        uint32_t getJitter(int pct);
+
+        uint32_t getSkipped() {return skipped;};
+
+    private:
+        int64_t getDeadline(int64_t n) {return origin + n * 1000000 / rate;};
+
+        static void onDeadline(void * arg);
+
+        esp_timer_handle_t timer = NULL;
+        TaskHandle_t task = NULL;
+        uint32_t notify_bit = 0;
+
+        bool running = false;
+        int rate = 1;
+
+        // start of the session and index of the next deadline
+        int64_t origin = 0;
+        int64_t next = 0;
+
+        // a deadline was skipped since the last frame; its interval is not a jitter sample
+        bool gap = true;
+        int64_t last_frame = 0;
+
+        uint32_t skipped = 0;
+
+        uint32_t samples[FRAME_JITTER_SAMPLES];
+        uint16_t sample_count = 0;
+        uint16_t sample_pos = 0;
+
+        const char * tag = "pacer";
+};
+
+#endif
@@ -0,0 +1,90 @@
+#include "frame_ring.h"
+#include "latency_stats.h"
+
+int CLFrameRing::init(size_t slot_size) {
+    for(int i=0; i < FRAME_RING_SIZE; i++) {
+        // the allocation failure of a vector is reported by an exception
+        try {
+            slots[i].data.reserve(slot_size);
+        }
+        catch(const std::bad_alloc &) {
+            ESP_LOGE(tag, "Failed to allocate frame slot %d (%u bytes)", i, slot_size);
+            // leave the memory to a retry with smaller slots
+            for(int j=0; j <= i; j++) std::vector<uint8_t>().swap(slots[j].data);
+            return FAIL;
+        }
+        slots[i].timestamp = 0;
+        slots[i].seq = 0;
+        slots[i].readers = 0;
+        slots[i].sent = false;
+    }
+    ESP_LOGI(tag, "Allocated %d frame slots of %u bytes", FRAME_RING_SIZE, slot_size);
+    return OK;
+}
+
+int CLFrameRing::push(const uint8_t * data, size_t len, int64_t timestamp) {
+    CamFrame * slot = nullptr;
+
+    // pick the oldest slot nobody is holding and take it out of circulation
+    portENTER_CRITICAL(&lock);
+    for(int i=0; i < FRAME_RING_SIZE; i++) {
+        CamFrame * s = &slots[i];
+        if(s == latest || s->readers) continue;
+        if(!slot || s->seq < slot->seq) slot = s;
+    }
+    if(slot) slot->seq = 0;
+    portEXIT_CRITICAL(&lock);
+
+    if(!slot) {
+        dropped++;
+        return FAIL;
+    }
+
+    // no re-allocation unless the frame is larger than any frame seen before in this slot
+    try {
+        slot->data.assign(data, data + len);
+    }
+    catch(const std::bad_alloc &) {
+        // the slot keeps seq 0, so it is free for the next frame
+        slot->data.clear();
+        dropped++;
+        ESP_LOGW(tag, "No memory for a frame of %u bytes", len);
+        return FAIL;
+    }
+    slot->timestamp = timestamp;
+    slot->sent = false;
+
+    portENTER_CRITICAL(&lock);
+    slot->seq = ++seq;
+    latest = slot;
+    portEXIT_CRITICAL(&lock);
+
+    return OK;
+}
+
+CamFrameHandle CLFrameRing::acquire() {
+    CamFrame * frame;
+    portENTER_CRITICAL(&lock);
+    frame = latest;
+    if(frame) frame->readers++;
+    portEXIT_CRITICAL(&lock);
+
+    if(!frame) return CamFrameHandle();
+
+    return CamFrameHandle(frame, [this](CamFrame * f) { release(f); });
+}
+
+void CLFrameRing::release(CamFrame * frame) {
+    if(!frame) return;
+    int64_t sent = 0;
+    portENTER_CRITICAL(&lock);
+    if(frame->readers) frame->readers--;
+    // the last client the frame was queued to has sent it; the slot may be reused right after the lock
+    if(!frame->readers && frame->sent) {
+        frame->sent = false;
+        sent = frame->timestamp;
+    }
+    portEXIT_CRITICAL(&lock);
+
+    if(sent) Latency.record(LATENCY_SENT, esp_timer_get_time() - sent);
+}
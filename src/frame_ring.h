@@ -0,0 +1,93 @@
+#ifndef frame_ring_h
+#define frame_ring_h
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+
+#include <memory>
+#include <new>
+#include <vector>
+
+#include <esp_log.h>
+
+#ifndef FRAME_RING_SIZE
+#define FRAME_RING_SIZE                 4
+#endif
+
+// Initial capacity of a frame slot. A slot is re-allocated if a frame doesn't fit.
+// Allocations of this size are served from PSRAM by the heap (CONFIG_SPIRAM_USE_MALLOC).
+#ifndef FRAME_SLOT_SIZE
+#define FRAME_SLOT_SIZE                 (96 * 1024)
+#endif
+// capacity of the slots if FRAME_SLOT_SIZE can't be allocated, e.g. without PSRAM
+#define FRAME_SLOT_MIN_SIZE             (16 * 1024)
+
+/**
+ * @brief Frame slot of the ring buffer
+ *
+ */
+struct CamFrame {
+    std::vector<uint8_t> data;  // JPEG data
+    int64_t timestamp;          // capture time, microseconds since boot
+    uint32_t seq;               // frame sequence number, 0 if the slot holds no valid frame
+    uint8_t readers;            // number of handles currently holding the slot
+    bool sent;                  // queued to a client; the send latency is recorded when the slot is released
+};
+
+/**
+ * @brief Reference counted handle to a frame in the ring. 
+ * The slot is returned to the ring when the last copy of the handle is destroyed.
+ */
+using CamFrameHandle = std::shared_ptr<CamFrame>;
+
+/**
+ * @brief JPEG data of a frame, sharing the reference count of the frame handle. 
+ * Can be queued to any number of WebSocket clients without copying the frame.
+ */
+using CamFrameBuffer = std::shared_ptr<std::vector<uint8_t>>;
+
+/**
+ * @brief Ring of frame slots in PSRAM
+ * The capture task copies each camera frame into a free slot and publishes it as the latest one.
+ * Consumers acquire a handle to the latest frame. A slot is never overwritten while a handle
+ * to it exists, so a slow consumer can only make the capture task drop frames, never block it.
+ */
+class CLFrameRing {
+    public:
+        /// @brief allocates the slots in PSRAM. The ring works without it as well, the slots are then
+        /// allocated by the first frames.
+        /// @param slot_size initial capacity of each slot
+        /// @return OK(0) or FAIL(1), with nothing allocated
+        int init(size_t slot_size = FRAME_SLOT_SIZE);
+
+        /// @brief copies a frame into a free slot and publishes it as the latest one
+        /// @return OK(0) or FAIL(1) if no slot is free or allocation failed
+        int push(const uint8_t * data, size_t len, int64_t timestamp);
+
+        /// @brief acquires the latest frame
+        /// @return handle to the frame or empty handle if no frame was captured yet
+        CamFrameHandle acquire();
+
+        /// @brief JPEG data of the frame, keeping the frame handle alive
+        static CamFrameBuffer getBuffer(const CamFrameHandle &frame) {return CamFrameBuffer(frame, &frame->data);};
+
+        uint32_t getLatestSeq() {return (latest?latest->seq:0);};
+        int64_t getLatestTimestamp() {return (latest?latest->timestamp:0);};
+
+        uint32_t getDropped() {return dropped;};
+
+    private:
+        void release(CamFrame * frame);
+
+        CamFrame slots[FRAME_RING_SIZE];
+        CamFrame * latest = nullptr;
+
+        uint32_t seq = 0;
+        uint32_t dropped = 0;
+
+        portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+        const char * tag = "ring";
+};
+
+#endif
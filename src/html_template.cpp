@@ -0,0 +1,148 @@
+#include "html_template.h"
+
+static const char * template_vars[TPL_VARS] = {"CAMNAME", "ERRORTEXT", "APPURL"};
+
+// FNV-1a, continued from the hash passed
+static uint32_t hashBytes(const uint8_t * data, size_t len, uint32_t hash = 2166136261u) {
+    for(size_t i=0; i < len; i++) hash = (hash ^ data[i]) * 16777619u;
+    return hash;
+}
+
+CLHtmlTemplate::~CLHtmlTemplate() {
+    if(_owned) free(_owned);
+}
+
+int CLHtmlTemplate::load(const uint8_t * data, size_t len) {
+    if(!data) return FAIL;
+
+    _data = data;
+    _len = len;
+    parse();
+    return OK;
+}
+
+int CLHtmlTemplate::loadFile(const char * path) {
+    // the file cache returns the same contents while the file is unchanged
+    CachedFile cached = Storage.readCached(path);
+    if(cached) {
+        if(cached == _file) return OK;
+        if(_owned) free(_owned);
+        _owned = nullptr;
+        _file = cached;
+        return load(cached->data, cached->size);
+    }
+    if(_owned) return OK;
+
+    // too big for the file cache
+    File file = Storage.open(path);
+    if(!file) {
+        ESP_LOGE(tag, "Failed to open %s", path);
+        return FAIL;
+    }
+
+    size_t len = file.size();
+    uint8_t * buffer = (uint8_t*) malloc(len + 1);
+    if(!buffer) {
+        file.close();
+        ESP_LOGE(tag, "No memory for %s (%d bytes)", path, (int)len);
+        return FAIL;
+    }
+
+    size_t read = file.read(buffer, len);
+    file.close();
+    if(read != len) {
+        free(buffer);
+        ESP_LOGE(tag, "Failed to read %s", path);
+        return FAIL;
+    }
+
+    _file = nullptr;
+    _owned = buffer;
+    return load(buffer, len);
+}
+
+void CLHtmlTemplate::parse() {
+    _segments.clear();
+    _vars = 0;
+    _rendered = nullptr;
+
+    size_t start = 0;
+    size_t pos = 0;
+    while(pos < _len) {
+        if(_data[pos] != '%') {
+            pos++;
+            continue;
+        }
+
+        // %% stands for a single %; the text is split after the first one
+        if(pos + 1 < _len && _data[pos + 1] == '%') {
+            _segments.push_back({(uint32_t)start, (uint32_t)(pos + 1 - start), -1});
+            start = pos = pos + 2;
+            continue;
+        }
+
+        size_t end = pos + 1;
+        while(end < _len && end - pos <= TEMPLATE_VAR_SIZE &&
+              ((_data[end] >= 'A' && _data[end] <= 'Z') || _data[end] == '_')) end++;
+
+        // not a placeholder, e.g. "width: 100%"
+        if(end >= _len || _data[end] != '%' || end == pos + 1 || end - pos > TEMPLATE_VAR_SIZE) {
+            pos++;
+            continue;
+        }
+
+        int8_t var = TPL_VARS;
+        for(int i=0; i < TPL_VARS; i++) {
+            if(strlen(template_vars[i]) == end - pos - 1 && !memcmp(template_vars[i], _data + pos + 1, end - pos - 1)) {
+                var = i;
+                _vars |= 1 << i;
+                break;
+            }
+        }
+
+        _segments.push_back({(uint32_t)start, (uint32_t)(pos - start), var});
+        start = pos = end + 1;
+    }
+
+    if(start < _len || _segments.empty())
+        _segments.push_back({(uint32_t)start, (uint32_t)(_len - start), -1});
+}
+
+TemplateBuffer CLHtmlTemplate::render(TemplateVarResolver resolver) {
+    if(!_data) return nullptr;
+
+    const char * values[TPL_VARS] = {nullptr};
+    uint32_t values_hash = 2166136261u;
+    for(int i=0; i < TPL_VARS; i++) {
+        if(!(_vars & (1 << i))) continue;
+        values[i] = resolver(i);
+        if(!values[i]) values[i] = "";
+        // the terminating zero separates the values
+        values_hash = hashBytes((const uint8_t*)values[i], strlen(values[i]) + 1, values_hash);
+    }
+
+    if(_rendered && values_hash == _values_hash) return _rendered;
+
+    size_t len = 0;
+    for(const TemplateSegment & seg : _segments) {
+        len += seg.len;
+        if(seg.var >= 0 && seg.var < TPL_VARS) len += strlen(values[seg.var]);
+    }
+
+    TemplateBuffer rendered = std::make_shared<std::vector<uint8_t>>(len);
+    uint8_t * out = rendered->data();
+    for(const TemplateSegment & seg : _segments) {
+        memcpy(out, _data + seg.offset, seg.len);
+        out += seg.len;
+        if(seg.var >= 0 && seg.var < TPL_VARS) {
+            size_t vlen = strlen(values[seg.var]);
+            memcpy(out, values[seg.var], vlen);
+            out += vlen;
+        }
+    }
+
+    _rendered = rendered;
+    _values_hash = values_hash;
+    _body_hash = hashBytes(rendered->data(), len);
+    return rendered;
+}
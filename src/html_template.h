@@ -0,0 +1,80 @@
+#ifndef html_template_h
+#define html_template_h
+
+#include <Arduino.h>
+
+#include <memory>
+#include <vector>
+
+#include <esp_log.h>
+
+#include "storage.h"
+
+// maximum length of a placeholder name, e.g. CAMNAME in %CAMNAME%
+#define TEMPLATE_VAR_SIZE               32
+
+// variables which can be used in the page templates
+enum TemplateVarEnum {TPL_CAMNAME, TPL_ERRORTEXT, TPL_APPURL, TPL_VARS};
+
+// returns the current value of a template variable
+typedef const char * (*TemplateVarResolver)(int var);
+
+using TemplateBuffer = std::shared_ptr<std::vector<uint8_t>>;
+
+/**
+ * @brief Static text of a template followed by a variable
+ *
+ */
+struct TemplateSegment {
+    uint32_t offset;
+    uint32_t len;
+    int8_t var;     // variable following the text, -1 for none
+};
+
+/**
+ * @brief Page template split into static segments and variable slots
+ * The template is parsed once, when it is loaded. The rendered page is kept until the value of
+ * one of its variables changes, so the pages are served as one body of a known length.
+ * Placeholders are %NAME% with NAME in capitals, %% is a literal %. Unknown variables render empty.
+ */
+class CLHtmlTemplate {
+    public:
+        ~CLHtmlTemplate();
+
+        /// @brief parses a template kept in memory (e.g. in flash) for the lifetime of the template
+        /// @return OK(0) or FAIL(1)
+        int load(const uint8_t * data, size_t len);
+
+        /// @brief reads and parses a template file through the file cache. Called again, the template
+        /// is parsed again only if the file has changed.
+        /// @return OK(0) or FAIL(1)
+        int loadFile(const char * path);
+
+        /// @brief renders the template, or returns the page rendered before if the variables are unchanged
+        TemplateBuffer render(TemplateVarResolver resolver);
+
+        // hash of the rendered page, for the ETag
+        uint32_t getHash() {return _body_hash;};
+
+        bool isLoaded() {return _data != nullptr;};
+
+    private:
+        void parse();
+
+        const uint8_t * _data = nullptr;
+        size_t _len = 0;
+        uint8_t * _owned = nullptr;     // file too big for the file cache
+        CachedFile _file = nullptr;
+
+        std::vector<TemplateSegment> _segments;
+        // bit mask of the variables used by the template
+        uint32_t _vars = 0;
+
+        TemplateBuffer _rendered = nullptr;
+        uint32_t _values_hash = 0;
+        uint32_t _body_hash = 0;
+
+        const char * tag = "template";
+};
+
+#endif
@@ -0,0 +1,62 @@
+#include "latency_stats.h"
+
+void IRAM_ATTR CLLatencyHistogram::record(int64_t us) {
+    if(us < 0) us = 0;
+    uint32_t val = (us > UINT32_MAX?UINT32_MAX:(uint32_t)us);
+
+    // bucket 0 takes [0, base), bucket n takes [base << (n-1), base << n)
+    uint32_t scaled = val / LATENCY_BUCKET_BASE;
+    int bucket = (scaled?32 - __builtin_clz(scaled):0);
+    if(bucket >= LATENCY_BUCKETS) bucket = LATENCY_BUCKETS - 1;
+
+    portENTER_CRITICAL(&lock);
+    counts[bucket]++;
+    total++;
+    sum += val;
+    if(val > max) max = val;
+    portEXIT_CRITICAL(&lock);
+}
+
+void CLLatencyHistogram::reset() {
+    portENTER_CRITICAL(&lock);
+    memset(counts, 0, sizeof(counts));
+    total = 0;
+    sum = 0;
+    max = 0;
+    portEXIT_CRITICAL(&lock);
+}
+
+void CLLatencyStats::reset() {
+    for(int i=0; i < LATENCY_STAGES; i++) stages[i].reset();
+    _reset_time = esp_timer_get_time();
+}
+
+const char * CLLatencyStats::getStageName(int stage) {
+    switch(stage) {
+        case LATENCY_FB_GET: return "fb_get";
+        case LATENCY_CALLBACK: return "callback";
+        case LATENCY_ENQUEUE: return "enqueue";
+        case LATENCY_SENT: return "sent";
+        default: return "unknown";
+    }
+}
+
+void CLLatencyStats::saveToJson(JsonObject jstr) {
+    // seconds since the statistics were reset
+    jstr[FPSTR(LATENCY_SINCE)] = (uint32_t)((esp_timer_get_time() - _reset_time) / 1000000);
+
+    JsonArray jaLimits = jstr[FPSTR(LATENCY_BUCKET_LIMITS)].to<JsonArray>();
+    for(int i=0; i < LATENCY_BUCKETS; i++) jaLimits.add(CLLatencyHistogram::getBucketLimit(i));
+
+    JsonObject joStages = jstr[FPSTR(LATENCY_STAGES_KEY)].to<JsonObject>();
+    for(int i=0; i < LATENCY_STAGES; i++) {
+        JsonObject joStage = joStages[getStageName(i)].to<JsonObject>();
+        joStage[FPSTR(LATENCY_COUNT)] = stages[i].getTotal();
+        joStage[FPSTR(LATENCY_MEAN)] = stages[i].getMean();
+        joStage[FPSTR(LATENCY_MAX)] = stages[i].getMax();
+        JsonArray jaBuckets = joStage[FPSTR(LATENCY_BUCKETS_KEY)].to<JsonArray>();
+        for(int j=0; j < LATENCY_BUCKETS; j++) jaBuckets.add(stages[i].getCount(j));
+    }
+}
+
+CLLatencyStats Latency;
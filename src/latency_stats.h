@@ -0,0 +1,82 @@
+#ifndef latency_stats_h
+#define latency_stats_h
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <esp_timer.h>
+#include <ArduinoJson.h>
+
+// Number of histogram buckets. The first bucket ends at LATENCY_BUCKET_BASE microseconds,
+// each next one is twice as wide, the last one is open.
+#define LATENCY_BUCKETS                 14
+#define LATENCY_BUCKET_BASE             250
+
+const char LATENCY_SINCE[] PROGMEM = "since";
+const char LATENCY_BUCKET_LIMITS[] PROGMEM = "bucket_us";
+const char LATENCY_STAGES_KEY[] PROGMEM = "stages";
+const char LATENCY_COUNT[] PROGMEM = "count";
+const char LATENCY_MEAN[] PROGMEM = "mean";
+const char LATENCY_MAX[] PROGMEM = "max";
+const char LATENCY_BUCKETS_KEY[] PROGMEM = "buckets";
+
+/**
+ * @brief Stages of the frame path. Except for LATENCY_FB_GET, which is the time spent in esp_camera_fb_get(),
+ * the latencies are measured from the frame timestamp of the camera driver.
+ */
+enum LatencyStageEnum {LATENCY_FB_GET,      // esp_camera_fb_get() wait
+                       LATENCY_CALLBACK,    // frame picked up by the stream fan-out
+                       LATENCY_ENQUEUE,     // frame queued to a WebSocket client / copied to the MJPEG response
+                       LATENCY_SENT,        // frame sent and acknowledged by all the WebSocket clients it was queued to
+                       LATENCY_STAGES};
+
+/**
+ * @brief Fixed-bucket latency histogram. Recording costs a bit scan and a short critical section,
+ * so it is always on.
+ */
+class CLLatencyHistogram {
+    public:
+        void IRAM_ATTR record(int64_t us);
+        void reset();
+
+        uint32_t getCount(int bucket) {return counts[bucket];};
+        uint32_t getTotal() {return total;};
+        uint32_t getMean() {return (total?sum / total:0);};
+        uint64_t getSum() {return sum;};
+        uint32_t getMax() {return max;};
+
+        // upper bound of the bucket in microseconds, 0 for the last (open) bucket
+        static uint32_t getBucketLimit(int bucket) {return (bucket < LATENCY_BUCKETS - 1?LATENCY_BUCKET_BASE << bucket:0);};
+
+    private:
+        uint32_t counts[LATENCY_BUCKETS] = {0};
+        uint32_t total = 0;
+        uint64_t sum = 0;
+        uint32_t max = 0;
+
+        portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+};
+
+/**
+ * @brief Latency histograms of the frame path stages
+ *
+ */
+class CLLatencyStats {
+    public:
+        void IRAM_ATTR record(LatencyStageEnum stage, int64_t us) {stages[stage].record(us);};
+        void reset();
+
+        CLLatencyHistogram & getStage(int stage) {return stages[stage];};
+
+        static const char * getStageName(int stage);
+
+        void saveToJson(JsonObject jstr);
+
+    private:
+        CLLatencyHistogram stages[LATENCY_STAGES];
+
+        int64_t _reset_time = 0;
+};
+
+extern CLLatencyStats Latency;
+
+#endif
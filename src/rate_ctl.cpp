@@ -0,0 +1,83 @@
+#include "rate_ctl.h"
+
+void CLRateController::reset(int q, int fs) {
+    quality = base_quality = q;
+    framesize = base_framesize = fs;
+    settle = 0;
+    ceiling_kbps = 0;
+    stable = 0;
+    fps = 0;
+    kbps = 0;
+}
+
+bool CLRateController::update(uint32_t frames, uint32_t bytes, uint32_t dropped, uint32_t interval_ms) {
+    if(!config.enabled || !interval_ms || config.target_fps <= 0) return false;
+
+    fps = frames * 1000.0f / interval_ms;
+    kbps = bytes * 8.0f / interval_ms;
+
+    if(settle > 0) {
+        settle--;
+        return false;
+    }
+
+    // nothing delivered and nothing dropped, the stream is idle
+    if(!frames && !dropped) return false;
+
+    // bitrate needed to deliver the target frame rate with the current average frame size
+    float demand_kbps = (frames ? (float)bytes / frames : 0) * 8.0f * config.target_fps / 1000.0f;
+
+    bool changed = false;
+    if(!frames || fps < config.target_fps * RATE_CTL_FPS_LOW) {
+        // the link can't carry these settings, so don't come back to them right away
+        if(frames) ceiling_kbps = demand_kbps;
+        stable = 0;
+        changed = degrade();
+    }
+    else if(config.target_kbps > 0 && demand_kbps > config.target_kbps) {
+        stable = 0;
+        changed = degrade();
+    }
+    else if(fps >= config.target_fps * RATE_CTL_FPS_OK) {
+        if(ceiling_kbps > 0 && ++stable >= RATE_CTL_PROBE_INTERVALS) {
+            ceiling_kbps = 0;
+            stable = 0;
+        }
+        changed = improve(demand_kbps);
+    }
+
+    if(changed) settle = RATE_CTL_SETTLE_INTERVALS;
+
+    return changed;
+}
+
+bool CLRateController::degrade() {
+    if(quality < config.max_quality) {
+        quality += config.quality_step;
+        if(quality > config.max_quality) quality = config.max_quality;
+        return true;
+    }
+    if(framesize > config.min_framesize) {
+        // the quality is kept, improve() brings it back as far as the smaller frame allows;
+        // restoring it here would overshoot the link right after the step down
+        framesize--;
+        return true;
+    }
+    return false;
+}
+
+bool CLRateController::improve(float demand_kbps) {
+    float budget = (config.target_kbps > 0 ? config.target_kbps : demand_kbps * RATE_CTL_FRAMESIZE_GROWTH) * RATE_CTL_HEADROOM;
+    if(ceiling_kbps > 0 && ceiling_kbps * RATE_CTL_HEADROOM < budget) budget = ceiling_kbps * RATE_CTL_HEADROOM;
+
+    if(framesize < base_framesize && demand_kbps * RATE_CTL_FRAMESIZE_GROWTH < budget) {
+        framesize++;
+        return true;
+    }
+    if(quality > base_quality && demand_kbps * RATE_CTL_QUALITY_GROWTH < budget) {
+        quality -= config.quality_step;
+        if(quality < base_quality) quality = base_quality;
+        return true;
+    }
+    return false;
+}
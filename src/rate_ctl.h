@@ -0,0 +1,96 @@
+#ifndef rate_ctl_h
+#define rate_ctl_h
+
+#include <stdint.h>
+
+/*
+ * The controller has no dependencies on Arduino or ESP-IDF, so it can be compiled on the host
+ * and fed with recorded frame size traces, see test/rate_ctl_test.cpp.
+ */
+
+// Ratio of the target, below which the achieved frame rate is considered too low
+#define RATE_CTL_FPS_LOW                0.85f
+// Ratio of the target, which the achieved frame rate must reach before improving the image
+#define RATE_CTL_FPS_OK                 0.95f
+// Headroom required in the bitrate budget before improving the image
+#define RATE_CTL_HEADROOM               0.8f
+// Estimated growth of the frame size for one quality step and for one framesize step
+#define RATE_CTL_QUALITY_GROWTH         1.15f
+#define RATE_CTL_FRAMESIZE_GROWTH       1.8f
+// Number of sampling intervals to skip after a change, while frames of the old settings are in flight
+#define RATE_CTL_SETTLE_INTERVALS       2
+// Number of intervals at the target frame rate after which the link is probed above the bitrate
+// which could not be delivered last time
+#define RATE_CTL_PROBE_INTERVALS        30
+
+/**
+ * @brief Settings of the adaptive stream controller
+ *
+ */
+struct RateCtlConfig {
+    bool enabled;
+    int target_fps;         // frame rate to hold for the slowest stream client
+    int target_kbps;        // bitrate budget per stream client, kbit/s
+    int max_quality;        // worst JPEG quality (highest value) the controller may apply
+    int min_framesize;      // smallest framesize the controller may apply
+    int quality_step;       // quality change applied per interval
+};
+
+/**
+ * @brief Closed-loop JPEG quality / framesize controller
+ * Once per sampling interval it compares the achieved frame rate and the bitrate demand of the
+ * stream with the targets. When the link can't carry the stream it lowers the JPEG quality first,
+ * then the framesize. When there is enough headroom it restores the framesize first, then the quality,
+ * never going beyond the settings the stream was started with.
+ */
+class CLRateController {
+    public:
+        void configure(const RateCtlConfig &cfg) {config = cfg;};
+        const RateCtlConfig & getConfig() {return config;};
+        bool isEnabled() {return config.enabled;};
+
+        /// @brief starts a new control session
+        /// @param q JPEG quality to start from, also the best quality allowed
+        /// @param fs framesize to start from, also the largest framesize allowed
+        void reset(int q, int fs);
+
+        /// @brief processes the statistics of one sampling interval
+        /// @param frames number of frames delivered to the slowest client
+        /// @param bytes number of bytes delivered to the slowest client
+        /// @param dropped number of frames dropped for the slowest client
+        /// @param interval_ms length of the interval
+        /// @return true if the quality or the framesize has changed
+        bool update(uint32_t frames, uint32_t bytes, uint32_t dropped, uint32_t interval_ms);
+
+        int getQuality() {return quality;};
+        int getFramesize() {return framesize;};
+        int getBaseQuality() {return base_quality;};
+        int getBaseFramesize() {return base_framesize;};
+
+        float getFps() {return fps;};
+        float getKbps() {return kbps;};
+
+    private:
+        bool degrade();
+        bool improve(float demand_kbps);
+
+        RateCtlConfig config = {false, 12, 2000, 40, 5, 2};
+
+        int quality = 0;
+        int framesize = 0;
+        int base_quality = 0;
+        int base_framesize = 0;
+
+        int settle = 0;
+
+        // bitrate demand of the settings which could not hold the frame rate, 0 if none;
+        // the image is not improved towards it until the link is probed again
+        float ceiling_kbps = 0;
+        int stable = 0;
+
+        // statistics of the last interval
+        float fps = 0;
+        float kbps = 0;
+};
+
+#endif
@@ -37,6 +37,8 @@ void CLStorage::listDir(const char * dirname, uint8_t levels){
 
 
 bool CLStorage::init() {
+  if(!_cache_mutex) _cache_mutex = xSemaphoreCreateMutex();
+
 #ifdef ARDUINO_LITTLEFS
   return fsStorage->begin(FORMAT_LITTLEFS_IF_FAILED, "/root");
 #elif ARDUINO_SPIFFS
@@ -76,17 +78,173 @@ bool CLStorage::init() {
 
 int CLStorage::readFileToString(char *path, String *s)
 {
-	File file = fsStorage->open(path);
-	if (!file)
-		return FAIL;
-
-	while (file.available())
-	{
-		char charRead = file.read();
-		*s += charRead;
-	}
+  CachedFile file = readFile(path);
+  if(!file)
+    return FAIL;
+
+  // one allocation for the whole file
+  if(!s->reserve(s->length() + file->size) || !s->concat((const char*)file->data, file->size))
+    return FAIL;
+  return OK;
+}
+
+CachedFile CLStorage::readFile(const char * path, bool psram) {
+  File file = fsStorage->open(path);
+  if(!file || file.isDirectory())
+    return nullptr;
+
+  CachedFile contents = readFile(file, psram);
   file.close();
-	return OK;
+  if(!contents)
+    ESP_LOGW(tag, "Failed to read %s", path);
+  return contents;
+}
+
+CachedFile CLStorage::readFile(File & file, bool psram) {
+  size_t size = file.size();
+
+  uint8_t * data = nullptr;
+  if(psram) data = (uint8_t*) heap_caps_malloc(size + 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if(!data) data = (uint8_t*) malloc(size + 1);
+  if(!data) return nullptr;
+
+  size_t pos = 0;
+  while(pos < size) {
+    size_t len = file.read(data + pos, min((size_t)STORAGE_READ_CHUNK, size - pos));
+    if(!len) break;
+    pos += len;
+  }
+  if(pos != size) {
+    free(data);
+    return nullptr;
+  }
+  data[size] = 0;
+
+  CachedFile contents = std::make_shared<FileData>();
+  contents->data = data;
+  contents->size = size;
+  return contents;
+}
+
+FileCacheEntry * CLStorage::findCached(const char * path) {
+  for(int i=0; i < FILE_CACHE_ENTRIES; i++)
+    if(_cache[i].file && !strcmp(_cache[i].path, path)) return &_cache[i];
+  return nullptr;
+}
+
+void CLStorage::dropCached(FileCacheEntry * entry) {
+  _cache_used -= entry->size;
+  // the contents are freed when the last response sending them is done
+  entry->file = nullptr;
+}
+
+void CLStorage::invalidate(const char * path) {
+  if(!_cache_mutex) return;
+
+  xSemaphoreTake(_cache_mutex, portMAX_DELAY);
+  FileCacheEntry * entry = findCached(path);
+  if(entry) dropCached(entry);
+  xSemaphoreGive(_cache_mutex);
+}
+
+bool CLStorage::rename(const String &from, const String &to) {
+  invalidate(from.c_str());
+  invalidate(to.c_str());
+
+  if(fsStorage->rename(from, to)) return true;
+  if(!fsStorage->exists(from) || !fsStorage->exists(to)) return false;
+
+  fsStorage->remove(to);
+  return fsStorage->rename(from, to);
+}
+
+CachedFile CLStorage::readCached(const char * path) {
+  if(!_cache_mutex) return nullptr;
+
+  uint32_t now = millis();
+  CachedFile cached = nullptr;
+
+  // recently checked files are served without touching the file system
+  xSemaphoreTake(_cache_mutex, portMAX_DELAY);
+  FileCacheEntry * entry = findCached(path);
+  if(entry && now - entry->checked < FILE_CACHE_CHECK_INTERVAL) {
+    entry->used = ++_cache_tick;
+    _cache_hits++;
+    cached = entry->file;
+  }
+  xSemaphoreGive(_cache_mutex);
+  if(cached) return cached;
+
+  File file = fsStorage->open(path);
+  if(!file || file.isDirectory()) {
+    invalidate(path);
+    return nullptr;
+  }
+
+  size_t size = file.size();
+  time_t mtime = file.getLastWrite();
+
+  xSemaphoreTake(_cache_mutex, portMAX_DELAY);
+  entry = findCached(path);
+  if(entry && entry->size == size && entry->mtime == mtime) {
+    entry->checked = now;
+    entry->used = ++_cache_tick;
+    _cache_hits++;
+    cached = entry->file;
+  }
+  else {
+    if(entry) dropCached(entry);
+    _cache_misses++;
+  }
+  xSemaphoreGive(_cache_mutex);
+
+  if(cached || size > FILE_CACHE_MAX_FILE || strlen(path) >= FILE_CACHE_PATH_SIZE) {
+    file.close();
+    return cached;
+  }
+
+  cached = readFile(file, true);
+  file.close();
+  if(!cached) {
+    ESP_LOGW(tag, "Failed to cache %s", path);
+    return nullptr;
+  }
+
+  // the least recently used files are evicted to make room for the new one
+  xSemaphoreTake(_cache_mutex, portMAX_DELAY);
+  entry = findCached(path);
+  if(entry) dropCached(entry);
+  while(true) {
+    FileCacheEntry * lru = nullptr;
+    FileCacheEntry * free_entry = nullptr;
+    for(int i=0; i < FILE_CACHE_ENTRIES; i++) {
+      if(!_cache[i].file) {
+        if(!free_entry) free_entry = &_cache[i];
+      }
+      else if(!lru || _cache[i].used < lru->used) lru = &_cache[i];
+    }
+    if(free_entry && _cache_used + size <= FILE_CACHE_SIZE) {
+      entry = free_entry;
+      break;
+    }
+    if(!lru) {
+      entry = nullptr;
+      break;
+    }
+    dropCached(lru);
+  }
+  if(entry) {
+    snprintf(entry->path, sizeof(entry->path), "%s", path);
+    entry->size = size;
+    entry->mtime = mtime;
+    entry->checked = now;
+    entry->used = ++_cache_tick;
+    entry->file = cached;
+    _cache_used += size;
+  }
+  xSemaphoreGive(_cache_mutex);
+
+  return cached;
 }
 
 unsigned int CLStorage::getSize() {
@@ -28,11 +28,61 @@
 #define STORAGE_UNITS STORAGE_UNITS_MB
 #endif
 
+#include <memory>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include <esp_log.h>
+#include <esp_heap_caps.h>
+
+// LRU cache of the file contents in PSRAM: total size, maximum size of a cached file and number of files, bytes
+#ifndef FILE_CACHE_SIZE
+#define FILE_CACHE_SIZE                 (256 * 1024)
+#endif
+#define FILE_CACHE_MAX_FILE             (64 * 1024)
+#define FILE_CACHE_ENTRIES              32
+#define FILE_CACHE_PATH_SIZE            48
+
+// a cached file is checked against the size and the modification time of the file at most this often, ms
+#define FILE_CACHE_CHECK_INTERVAL       2000
+
+// size of the blocks the files are read in, a multiple of the SD card sector size
+#ifndef STORAGE_READ_CHUNK
+#define STORAGE_READ_CHUNK              4096
+#endif
 
 const char STORAGE_SIZE[] PROGMEM = "storage_size";
 const char STORAGE_USED[] PROGMEM = "storage_used";
 const char STORAGE_UNITS_STR[] PROGMEM = "storage_units";
+const char STORAGE_CACHE_HITS[] PROGMEM = "cache_hits";
+const char STORAGE_CACHE_MISSES[] PROGMEM = "cache_misses";
+const char STORAGE_CACHE_USED[] PROGMEM = "cache_used";
+
+/**
+ * @brief Contents of a file in PSRAM. Freed when the last handle to it is released, so a response 
+ * can keep sending a file which has been evicted from the cache in the meantime.
+ * 
+ */
+struct FileData {
+    uint8_t * data;
+    size_t size;
+    ~FileData() {free(data);};
+};
+
+using CachedFile = std::shared_ptr<FileData>;
+
+/**
+ * @brief Entry of the file cache
+ * 
+ */
+struct FileCacheEntry {
+    char path[FILE_CACHE_PATH_SIZE];
+    size_t size;
+    time_t mtime;
+    uint32_t checked;       // time of the last check against the file, ms
+    uint32_t used;          // LRU counter value of the last access
+    CachedFile file;
+};
 
 /**
  * @brief Storage Manager
@@ -46,6 +96,13 @@ class CLStorage {
         /// @param s pointer to the String buffer
         /// @return OK(0) or FAIL(1)
         int readFileToString(char *path, String *s);
+
+        /// @brief reads a whole file into one buffer allocated from the size of the file, in blocks 
+        /// of STORAGE_READ_CHUNK bytes. The contents are followed by a terminating zero.
+        /// @param path file name
+        /// @param psram allocate the buffer in PSRAM
+        /// @return contents of the file, or an empty handle if the file can't be read
+        CachedFile readFile(const char * path, bool psram = false);
         
         bool init();
 
@@ -58,9 +115,31 @@ class CLStorage {
         unsigned int getUsed();
         int capacityUnits();
 
-        File open(const String &path, const char *mode = "r", const bool create = false) {return fsStorage->open(path, mode, create);};
+        // a file opened for writing is dropped from the cache
+        File open(const String &path, const char *mode = "r", const bool create = false) {
+            if(*mode != 'r') invalidate(path.c_str());
+            return fsStorage->open(path, mode, create);
+        };
         bool exists(const String &path) {return fsStorage->exists(path);};
-        bool remove(const String &path) {return fsStorage->remove(path);};
+        bool remove(const String &path) {invalidate(path.c_str()); return fsStorage->remove(path);};
+
+        /// @brief renames a file, replacing the target. Atomic on LittleFS only: where the file system can't
+        /// rename over an existing file (SPIFFS, FAT), the target is removed first and then the file is renamed,
+        /// so a reset in between leaves the source file only.
+        /// @return true if renamed
+        bool rename(const String &from, const String &to);
+
+        /// @brief reads a whole file through the LRU cache of the file contents
+        /// @param path file name
+        /// @return contents of the file, or an empty handle if the file can't be read or is too big to be cached
+        CachedFile readCached(const char * path);
+
+        /// @brief drops a file from the cache
+        void invalidate(const char * path);
+
+        uint32_t getCacheHits() {return _cache_hits;};
+        uint32_t getCacheMisses() {return _cache_misses;};
+        size_t getCacheUsed() {return _cache_used;};
 
 #ifdef ARDUINO_LITTLEFS
         fs::LittleFSFS & getFS() {return *fsStorage;};
@@ -83,6 +162,20 @@ class CLStorage {
         fs::SDMMCFS * const fsStorage = &SD_MMC; 
 #endif
 
+        CachedFile readFile(File & file, bool psram);
+
+        // finds an entry of the cache; called with the cache locked
+        FileCacheEntry * findCached(const char * path);
+        void dropCached(FileCacheEntry * entry);
+
+        FileCacheEntry _cache[FILE_CACHE_ENTRIES] = {};
+        // the entries are released, and their contents may be freed, with the cache locked, so it is a mutex
+        SemaphoreHandle_t _cache_mutex = NULL;
+        uint32_t _cache_tick = 0;
+        size_t _cache_used = 0;
+        uint32_t _cache_hits = 0;
+        uint32_t _cache_misses = 0;
+
         const char * tag = "storage"; 
 
 };
@@ -0,0 +1,133 @@
+/*
+ * Host test of the adaptive stream controller. Replays bandwidth traces through a simple model
+ * of the link and of the JPEG frame size, and checks the order of the changes and their stability.
+ *
+ *   make -C test
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include "rate_ctl.h"
+
+#define BASE_QUALITY    10
+#define BASE_FRAMESIZE  9
+#define TARGET_FPS      10
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+    if(!(cond)) { \
+        failures++; \
+        printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+    } \
+} while(0)
+
+struct Step {
+    int t;
+    int quality;
+    int framesize;
+};
+
+// frame size grows with the area of the frame and falls with the JPEG quality value
+static uint32_t frameBytes(int quality, int framesize) {
+    return 200u * (framesize + 1) * (framesize + 1) * (70 - quality) / 64;
+}
+
+static void configure(CLRateController &ctl) {
+    ctl.configure({true, TARGET_FPS, 2000, 40, 5, 5});
+    ctl.reset(BASE_QUALITY, BASE_FRAMESIZE);
+}
+
+// one sampling interval of a second over a link of the capacity in kbit/s
+static bool interval(CLRateController &ctl, int capacity_kbps) {
+    uint32_t bytes = frameBytes(ctl.getQuality(), ctl.getFramesize());
+    uint32_t frames = std::min<uint32_t>(TARGET_FPS, capacity_kbps * 125u / bytes);
+    return ctl.update(frames, frames * bytes, TARGET_FPS - frames, 1000);
+}
+
+// the link drops to 600 kbit/s for 100 s and recovers
+static void testCongestion() {
+    CLRateController ctl;
+    configure(ctl);
+
+    std::vector<Step> steps;
+    Step prev = {0, ctl.getQuality(), ctl.getFramesize()};
+    for(int t=0; t < 300; t++) {
+        bool congested = (t >= 20 && t < 120);
+        if(!interval(ctl, congested?600:4000)) continue;
+
+        Step step = {t, ctl.getQuality(), ctl.getFramesize()};
+        if(congested) {
+            CHECK(step.quality >= prev.quality && step.framesize <= prev.framesize,
+                  "t=%d: improved during congestion (q %d->%d, fs %d->%d)", t, prev.quality, step.quality, prev.framesize, step.framesize);
+            // the framesize is the last resort
+            if(step.framesize < prev.framesize)
+                CHECK(prev.quality == 40, "t=%d: framesize lowered at quality %d", t, prev.quality);
+        }
+        else if(t >= 120) {
+            CHECK(step.quality <= prev.quality && step.framesize >= prev.framesize,
+                  "t=%d: degraded on a free link (q %d->%d, fs %d->%d)", t, prev.quality, step.quality, prev.framesize, step.framesize);
+            // the framesize is restored before the quality
+            if(step.quality < prev.quality)
+                CHECK(prev.framesize == BASE_FRAMESIZE, "t=%d: quality improved at framesize %d", t, prev.framesize);
+        }
+        steps.push_back(step);
+        prev = step;
+    }
+
+    CHECK(!steps.empty() && steps.front().t == 20 && steps.front().framesize == BASE_FRAMESIZE && steps.front().quality > BASE_QUALITY,
+          "the quality is not the first to degrade");
+    CHECK(ctl.getQuality() == BASE_QUALITY && ctl.getFramesize() == BASE_FRAMESIZE,
+          "not back to the base settings after the congestion (q %d, fs %d)", ctl.getQuality(), ctl.getFramesize());
+}
+
+// on a link of constant capacity the settings converge; the only changes left are the probes
+// of the link, at most one step up and back per RATE_CTL_PROBE_INTERVALS
+static void testStability() {
+    for(int capacity=200; capacity <= 3000; capacity += 25) {
+        CLRateController ctl;
+        configure(ctl);
+
+        std::vector<int> changes;
+        for(int t=0; t < 600; t++) {
+            if(interval(ctl, capacity) && t >= 200) changes.push_back(t);
+        }
+
+        for(size_t i=0; i < changes.size(); i++) {
+            size_t n = 0;
+            while(i + n < changes.size() && changes[i + n] < changes[i] + RATE_CTL_PROBE_INTERVALS) n++;
+            CHECK(n <= 2, "%d kbit/s: %d changes within %d intervals from t=%d", 
+                  capacity, (int)n, RATE_CTL_PROBE_INTERVALS, changes[i]);
+        }
+    }
+}
+
+// nothing changes while the frames of the last change are in flight
+static void testSettle() {
+    CLRateController ctl;
+    configure(ctl);
+
+    int last = -1;
+    for(int t=0; t < 100; t++) {
+        if(!interval(ctl, 300)) continue;
+        if(last >= 0) CHECK(t - last > RATE_CTL_SETTLE_INTERVALS, "t=%d: changed %d intervals after the last change", t, t - last);
+        last = t;
+    }
+}
+
+int main() {
+    testCongestion();
+    testStability();
+    testSettle();
+
+    if(failures) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("rate_ctl: all checks passed\n");
+    return 0;
+}